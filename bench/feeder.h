@@ -0,0 +1,131 @@
+/* ------------------------------------------------------------------------- */
+/* DSS-Extensions KLUSolve (KLUSolveX)                                       */
+/* Copyright (c) 2019-2024, Paulo Meira                                      */
+/* Licensed under the GNU Lesser General Public License (LGPL) v 2.1         */
+/* ------------------------------------------------------------------------- */
+
+// Synthetic 3-phase distribution feeders for the KLUSolveX benchmarks
+
+#ifndef DSS_EXTENSIONS_KLUSOLVEX_BENCH_FEEDER_H
+#define DSS_EXTENSIONS_KLUSOLVEX_BENCH_FEEDER_H
+
+#include <complex>
+#include <random>
+#include <utility>
+#include <vector>
+#include <Eigen/Dense>
+
+struct Primitive
+{
+    std::vector<unsigned int> nodes; // 1-based, 0 is ground
+    std::vector<std::complex<double>> Y; // column-major, nodes.size() squared
+};
+
+struct Feeder
+{
+    unsigned int nNodes; // 3 per bus
+    unsigned int nBuses;
+    std::vector<Primitive> primitives;
+};
+
+// 3-phase series element between two buses, with mutual coupling
+inline Primitive MakeLine(unsigned int busFrom, unsigned int busTo, double length)
+{
+    const std::complex<double> zSelf(0.3 * length, 0.6 * length), zMutual(0.1 * length, 0.25 * length);
+    Eigen::Matrix3cd Z;
+    Z.setConstant(zMutual);
+    Z.diagonal().setConstant(zSelf);
+    const Eigen::Matrix3cd Ys = Z.inverse();
+
+    Primitive p;
+    p.nodes = { 3 * busFrom + 1, 3 * busFrom + 2, 3 * busFrom + 3, 3 * busTo + 1, 3 * busTo + 2, 3 * busTo + 3 };
+    Eigen::Matrix<std::complex<double>, 6, 6> Y;
+    Y << Ys, -Ys, -Ys, Ys;
+    p.Y.assign(Y.data(), Y.data() + 36);
+    return p;
+}
+
+// Wye-connected shunt (load or source equivalent) at a bus
+inline Primitive MakeShunt(unsigned int bus, std::complex<double> y)
+{
+    Primitive p;
+    p.nodes = { 3 * bus + 1, 3 * bus + 2, 3 * bus + 3 };
+    p.Y.assign(9, std::complex<double>(0));
+    p.Y[0] = p.Y[4] = p.Y[8] = y;
+    return p;
+}
+
+/*
+Generates a feeder with about nNodes nodes. Bus 0 is the substation, with a
+stiff source equivalent. Most buses continue the current branch, the others
+start laterals from random upstream buses. meshFraction adds that fraction of
+buses as extra ties between random pairs of buses.
+*/
+inline Feeder GenerateFeeder(unsigned int nNodes, double meshFraction, unsigned int seed)
+{
+    Feeder feeder;
+    feeder.nBuses = (nNodes + 2) / 3;
+    if (feeder.nBuses < 2)
+        feeder.nBuses = 2;
+    feeder.nNodes = 3 * feeder.nBuses;
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> lengthDist(0.05, 0.5);
+    std::uniform_real_distribution<double> loadDist(0.5, 2.0);
+    std::uniform_real_distribution<double> unit(0, 1);
+
+    feeder.primitives.reserve(2 * feeder.nBuses + size_t(meshFraction * feeder.nBuses));
+    feeder.primitives.push_back(MakeShunt(0, std::complex<double>(1e3, -1e4)));
+    for (unsigned int bus = 1; bus < feeder.nBuses; ++bus)
+    {
+        unsigned int parent = bus - 1;
+        if (unit(rng) < 0.2)
+            parent = std::uniform_int_distribution<unsigned int>(0, bus - 1)(rng);
+
+        feeder.primitives.push_back(MakeLine(parent, bus, lengthDist(rng)));
+        feeder.primitives.push_back(MakeShunt(bus, std::complex<double>(1e-3 * loadDist(rng), -2e-4 * loadDist(rng))));
+    }
+
+    const unsigned int nTies = static_cast<unsigned int>(meshFraction * feeder.nBuses);
+    std::uniform_int_distribution<unsigned int> busDist(0, feeder.nBuses - 1);
+    for (unsigned int k = 0; k < nTies; ++k)
+    {
+        const unsigned int a = busDist(rng), b = busDist(rng);
+        if (a != b)
+            feeder.primitives.push_back(MakeLine(a, b, lengthDist(rng)));
+    }
+    return feeder;
+}
+
+/*
+Generates nIslands independent feeders with about nNodes nodes in total, as
+in a substation model with open bus ties. Each feeder is an island of the
+system, and a separate block of its block triangular form.
+*/
+inline Feeder GenerateIslands(unsigned int nNodes, unsigned int nIslands, double meshFraction, unsigned int seed)
+{
+    if (nIslands <= 1)
+        return GenerateFeeder(nNodes, meshFraction, seed);
+
+    Feeder system;
+    system.nNodes = 0;
+    system.nBuses = 0;
+    for (unsigned int k = 0; k < nIslands; ++k)
+    {
+        Feeder feeder = GenerateFeeder(nNodes / nIslands, meshFraction, seed + k);
+        for (Primitive& p : feeder.primitives)
+        {
+            for (unsigned int& node : p.nodes)
+            {
+                if (node)
+                    node += system.nNodes;
+            }
+            system.primitives.push_back(std::move(p));
+        }
+        system.nNodes += feeder.nNodes;
+        system.nBuses += feeder.nBuses;
+    }
+    return system;
+}
+
+#endif // #ifndef DSS_EXTENSIONS_KLUSOLVEX_BENCH_FEEDER_H
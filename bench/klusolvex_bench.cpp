@@ -0,0 +1,676 @@
+/* ------------------------------------------------------------------------- */
+/* DSS-Extensions KLUSolve (KLUSolveX)                                       */
+/* Copyright (c) 2019-2024, Paulo Meira                                      */
+/* Licensed under the GNU Lesser General Public License (LGPL) v 2.1         */
+/* ------------------------------------------------------------------------- */
+
+/*
+Benchmark for KLUSolveX, using synthetic distribution feeders.
+
+Each case generates a 3-phase feeder (radial, or meshed with extra ties),
+assembles its admittance matrix through AddPrimitiveMatrix and measures the
+assembly, analysis, factorization, refactorization and solve phases. With
+--islands, the system is split in that many independent feeders, and the
+refactorization after a change in a single island is also measured with
+Option_BlockFactorization, as well as the refactorization of all the islands
+and the solves with Option_ParallelFactorization and Option_ParallelSolve, for
+1, 2, 4... up to --threads threads (also used for the solve contexts and for
+ResidualSparseSet with Option_ParallelMultiply). MultiplySparseSet and
+ResidualSparseSet are timed on the assembled matrix, as well as reading it
+with GetCompressedMatrix (copy) and GetCompressedMatrixView (borrowed). The
+fill (factor_nnz), flops and analysis/factorization times are also reported
+for each fill-reducing ordering of SetOrdering, and the currents of all the
+primitives (b = Y * x) are computed with one mvmult call per primitive, with
+mvmult_batch per order, with a single mvmult_ragged call and, gathering the
+voltages and adding the currents by node, with AccumulatePrimitiveCurrents.
+The time per product of mvmult_batch is also measured once for each order and
+each set of kernels of mvmult_kernels supported by the CPU, and repeated in
+every case. Results are written as one JSON object per line (or CSV) to
+stdout, to be tracked across releases.
+
+Usage: klusolvex_bench [--sizes 1000,10000,100000] [--mesh 0.0] [--repeat 20]
+                       [--threads N] [--nrhs 16] [--seed 1] [--islands 1] [--csv]
+*/
+
+#include "KLUSolveX.h"
+#include "feeder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+double SecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct BenchOptions
+{
+    std::vector<unsigned int> sizes;
+    double meshFraction;
+    unsigned int repeat;
+    unsigned int maxThreads;
+    unsigned int nRHS;
+    unsigned int seed;
+    unsigned int islands;
+    bool csv;
+};
+
+// fill-reducing orderings compared in each case
+const struct
+{
+    unsigned int method;
+    const char* name;
+} orderings[] = {
+    { Ordering_AMD, "amd" },
+    { Ordering_COLAMD, "colamd" },
+    { Ordering_METIS, "metis" }
+};
+const size_t nOrderings = sizeof(orderings) / sizeof(orderings[0]);
+
+// kernels of mvmult_kernels and the orders they cover
+const struct
+{
+    int32_t kernels;
+    const char* name;
+} mvmultKernels[] = {
+    { MvmultKernels_Generic, "generic" },
+    { MvmultKernels_AVX2, "avx2" },
+    { MvmultKernels_AVX512, "avx512" },
+    { MvmultKernels_NEON, "neon" }
+};
+const int32_t mvmultOrders[] = { 1, 2, 3, 4, 6, 8 };
+const size_t nMvmultOrders = sizeof(mvmultOrders) / sizeof(mvmultOrders[0]);
+
+struct KernelResult
+{
+    const char* name;
+    double ns[nMvmultOrders]; // per product, by order
+};
+
+struct OrderingResult
+{
+    unsigned int factorNNZ;
+    double flops;
+    double analyze;
+    double factor;
+};
+
+struct BenchResult
+{
+    const char* topology;
+    unsigned int nodes;
+    unsigned int primitives;
+    unsigned int nnz;
+    unsigned int factorNNZ;
+    double flops;
+    double addPrimitives; // AddPrimitiveMatrix calls, full assembly
+    double assembly; // triplets to CSC
+    double analyze;
+    double factor;
+    double refactor;
+    double refactorBlocks; // same change, refactoring only the affected island
+    std::vector<double> parallelRefactor; // all islands changed, by number of threads
+    std::vector<double> parallelSolve; // average per call, by number of threads
+    double solve; // average per call
+    double solveMultiPerRHS;
+    double multiply; // MultiplySparseSet, average per call
+    double residual; // ResidualSparseSet, average per call
+    std::vector<double> parallelResidual; // same, with Option_ParallelMultiply, by number of threads
+    double matrixCopy; // GetCompressedMatrix, average per call
+    double matrixView; // GetCompressedMatrixView, average per call
+    double rebuildMapped; // ZeroSparseSet + AddPrimitiveMatrix + factor, with Option_ReuseAssemblyMap
+    double rebuildFull; // same, without the assembly map
+    double rebuildReserved; // same, with the buffers kept by ReserveSparseSet
+    std::vector<double> contextSolvesPerSecond; // by number of threads
+    OrderingResult ordering[nOrderings];
+    double mvmultLoop; // all the primitives, one mvmult call each
+    double mvmultBatch; // one mvmult_batch call per order
+    double mvmultRagged; // a single mvmult_ragged call
+    double currents; // AccumulatePrimitiveCurrents, node voltages to injections
+    uint64_t kluMemoryPeak;
+    uint64_t matrixBytes;
+};
+
+void AddFeeder(void* handle, const Feeder& feeder)
+{
+    for (const Primitive& p : feeder.primitives)
+    {
+        AddPrimitiveMatrix(handle, p.nodes.size(), const_cast<unsigned int*>(p.nodes.data()), reinterpret_cast<complex*>(const_cast<std::complex<double>*>(p.Y.data())));
+    }
+}
+
+// AddPrimitiveMatrix calls and the first factorization, with its assembly and analysis
+void TimeFactor(void* handle, const Feeder& feeder, BenchResult& res)
+{
+    const Clock::time_point start = Clock::now();
+    AddFeeder(handle, feeder);
+    res.addPrimitives = SecondsSince(start);
+
+    KLUSolveXStats stats;
+    FactorSparseMatrix(handle);
+    GetStats(handle, &stats);
+    res.assembly = stats.assembly.lastTime;
+    res.analyze = stats.analyze.lastTime;
+    res.factor = stats.factor.lastTime;
+    res.matrixBytes = stats.assembly.bytesAllocated;
+    GetNNZ(handle, &res.nnz);
+    GetSparseNNZ(handle, &res.factorNNZ);
+    GetFlops(handle, &res.flops);
+}
+
+// refactorization time after a change to a single entry
+double TimeRefactor(void* handle)
+{
+    IncrementMatrixElement(handle, 1, 1, 1e-3, -1e-3);
+    const Clock::time_point start = Clock::now();
+    FactorSparseMatrix(handle);
+    return SecondsSince(start);
+}
+
+// one right-hand side at a time, then all of them in one call; average per right-hand side
+void TimeSolves(const BenchOptions& opts, void* handle, unsigned int n, std::vector<std::complex<double>>& B, std::vector<std::complex<double>>& X, BenchResult& res)
+{
+    Clock::time_point start = Clock::now();
+    for (unsigned int r = 0; r < opts.repeat; ++r)
+        SolveSparseSet(handle, reinterpret_cast<complex*>(X.data()), reinterpret_cast<complex*>(B.data()));
+    res.solve = SecondsSince(start) / opts.repeat;
+
+    start = Clock::now();
+    for (unsigned int r = 0; r < opts.repeat; ++r)
+        SolveSparseSetMulti(handle, opts.nRHS, reinterpret_cast<complex*>(X.data()), reinterpret_cast<complex*>(B.data()), n);
+    res.solveMultiPerRHS = SecondsSince(start) / (double(opts.repeat) * opts.nRHS);
+}
+
+// y = A * x and b - A * x on the assembled matrix, serial and then by rows for
+// each number of threads
+void TimeMultiply(const BenchOptions& opts, void* handle, unsigned int n, std::vector<std::complex<double>>& B, std::vector<std::complex<double>>& X, BenchResult& res)
+{
+    std::vector<std::complex<double>> Y(n);
+    Clock::time_point start = Clock::now();
+    for (unsigned int r = 0; r < opts.repeat; ++r)
+        MultiplySparseSet(handle, reinterpret_cast<complex*>(X.data()), reinterpret_cast<complex*>(Y.data()));
+    res.multiply = SecondsSince(start) / opts.repeat;
+
+    double residualNorm;
+    start = Clock::now();
+    for (unsigned int r = 0; r < opts.repeat; ++r)
+        ResidualSparseSet(handle, reinterpret_cast<complex*>(X.data()), reinterpret_cast<complex*>(B.data()), reinterpret_cast<complex*>(Y.data()), &residualNorm);
+    res.residual = SecondsSince(start) / opts.repeat;
+
+    SetOptions(handle, ReuseNumericFactorization | Option_ParallelMultiply);
+    for (unsigned int nThreads = 1; nThreads <= opts.maxThreads; nThreads *= 2)
+    {
+        SetThreadCount(handle, nThreads);
+        start = Clock::now();
+        for (unsigned int r = 0; r < opts.repeat; ++r)
+            ResidualSparseSet(handle, reinterpret_cast<complex*>(X.data()), reinterpret_cast<complex*>(B.data()), reinterpret_cast<complex*>(Y.data()), &residualNorm);
+        res.parallelResidual.push_back(SecondsSince(start) / opts.repeat);
+    }
+    SetOptions(handle, ReuseNumericFactorization);
+    SetThreadCount(handle, 0);
+}
+
+// reading the assembled matrix, copied by GetCompressedMatrix or borrowed
+void TimeMatrixAccess(const BenchOptions& opts, void* handle, unsigned int n, BenchResult& res)
+{
+    std::vector<unsigned int> colP(n + 1), rowIdx(res.nnz);
+    std::vector<std::complex<double>> values(res.nnz);
+    Clock::time_point start = Clock::now();
+    for (unsigned int r = 0; r < opts.repeat; ++r)
+        GetCompressedMatrix(handle, n + 1, res.nnz, colP.data(), rowIdx.data(), reinterpret_cast<complex*>(values.data()));
+    res.matrixCopy = SecondsSince(start) / opts.repeat;
+
+    KLUSolveXMatrixView view;
+    start = Clock::now();
+    for (unsigned int r = 0; r < opts.repeat; ++r)
+        GetCompressedMatrixView(handle, &view);
+    res.matrixView = SecondsSince(start) / opts.repeat;
+}
+
+// solve contexts, one per thread, all sharing the same factorization
+void TimeContextSolves(const BenchOptions& opts, void* handle, unsigned int n, std::vector<std::complex<double>>& B, BenchResult& res)
+{
+    for (unsigned int nThreads = 1; nThreads <= opts.maxThreads; nThreads *= 2)
+    {
+        std::vector<std::thread> threads;
+        std::vector<std::vector<std::complex<double>>> results(nThreads, std::vector<std::complex<double>>(n));
+        const Clock::time_point start = Clock::now();
+        for (unsigned int t = 0; t < nThreads; ++t)
+        {
+            threads.emplace_back([&, t]() {
+                void* ctx = NewSolveContext(handle);
+                for (unsigned int r = 0; r < opts.repeat; ++r)
+                    SolveSparseSetWithContext(ctx, reinterpret_cast<complex*>(results[t].data()), reinterpret_cast<complex*>(B.data()));
+                DeleteSolveContext(ctx);
+            });
+        }
+        for (std::thread& th : threads)
+            th.join();
+        res.contextSolvesPerSecond.push_back(double(nThreads) * opts.repeat / SecondsSince(start));
+    }
+}
+
+// the same change, with each island factored on its own
+double TimeBlockRefactor(const Feeder& feeder)
+{
+    void* handle = NewSparseSet(feeder.nNodes);
+    SetOptions(handle, ReuseNumericFactorization | Option_BlockFactorization);
+    AddFeeder(handle, feeder);
+    FactorSparseMatrix(handle);
+    const double t = TimeRefactor(handle);
+    DeleteSparseSet(handle);
+    return t;
+}
+
+// all islands changed, with the blocks factored concurrently; best of the
+// repetitions for each number of threads
+void TimeParallelRefactor(const BenchOptions& opts, const Feeder& feeder, BenchResult& res)
+{
+    void* handle = NewSparseSet(feeder.nNodes);
+    SetOptions(handle, ReuseNumericFactorization | Option_BlockFactorization | Option_ParallelFactorization);
+    AddFeeder(handle, feeder);
+    for (unsigned int nThreads = 1; nThreads <= opts.maxThreads; nThreads *= 2)
+    {
+        SetThreadCount(handle, nThreads);
+        FactorSparseMatrix(handle); // starts the threads
+        double best = 0;
+        for (unsigned int r = 0; r < opts.repeat; ++r)
+        {
+            for (unsigned int i = 1; i <= feeder.nNodes; i += 3)
+                IncrementMatrixElement(handle, i, i, 1e-6, -1e-6);
+
+            const Clock::time_point start = Clock::now();
+            FactorSparseMatrix(handle);
+            const double elapsed = SecondsSince(start);
+            best = r ? std::min(best, elapsed) : elapsed;
+        }
+        res.parallelRefactor.push_back(best);
+    }
+    DeleteSparseSet(handle);
+}
+
+// solves with the islands solved concurrently, for each number of threads
+void TimeParallelSolves(const BenchOptions& opts, const Feeder& feeder, std::vector<std::complex<double>>& B, std::vector<std::complex<double>>& X, BenchResult& res)
+{
+    void* handle = NewSparseSet(feeder.nNodes);
+    SetOptions(handle, ReuseNumericFactorization | Option_BlockFactorization | Option_ParallelFactorization | Option_ParallelSolve);
+    AddFeeder(handle, feeder);
+    for (unsigned int nThreads = 1; nThreads <= opts.maxThreads; nThreads *= 2)
+    {
+        SetThreadCount(handle, nThreads);
+        FactorSparseMatrix(handle); // starts the threads
+        const Clock::time_point start = Clock::now();
+        for (unsigned int r = 0; r < opts.repeat; ++r)
+            SolveSparseSet(handle, reinterpret_cast<complex*>(X.data()), reinterpret_cast<complex*>(B.data()));
+        res.parallelSolve.push_back(SecondsSince(start) / opts.repeat);
+    }
+    DeleteSparseSet(handle);
+}
+
+// fill and factorization cost of each ordering
+void TimeOrderings(const Feeder& feeder, BenchResult& res)
+{
+    for (size_t k = 0; k < nOrderings; ++k)
+    {
+        void* handle = NewSparseSet(feeder.nNodes);
+        SetOrdering(handle, orderings[k].method, 0, nullptr);
+        AddFeeder(handle, feeder);
+        FactorSparseMatrix(handle);
+
+        OrderingResult& o = res.ordering[k];
+        KLUSolveXStats stats;
+        GetStats(handle, &stats);
+        o.analyze = stats.analyze.lastTime;
+        o.factor = stats.factor.lastTime;
+        GetSparseNNZ(handle, &o.factorNNZ);
+        GetFlops(handle, &o.flops);
+        DeleteSparseSet(handle);
+    }
+}
+
+double TimeRebuild(void* handle, const Feeder& feeder)
+{
+    const Clock::time_point start = Clock::now();
+    ZeroSparseSet(handle);
+    AddFeeder(handle, feeder);
+    FactorSparseMatrix(handle);
+    return SecondsSince(start);
+}
+
+// repeated Y rebuilds, with and without the assembly map or the reserved buffers
+void TimeRebuilds(const Feeder& feeder, BenchResult& res)
+{
+    void* handle = NewSparseSet(feeder.nNodes);
+    SetOptions(handle, ReuseNumericFactorization);
+    TimeRebuild(handle, feeder); // first assembly
+    res.rebuildFull = TimeRebuild(handle, feeder);
+    DeleteSparseSet(handle);
+
+    handle = NewSparseSet(feeder.nNodes);
+    SetOptions(handle, ReuseNumericFactorization | Option_ReuseAssemblyMap);
+    TimeRebuild(handle, feeder); // records the map
+    TimeRebuild(handle, feeder); // first replay
+    res.rebuildMapped = TimeRebuild(handle, feeder);
+    DeleteSparseSet(handle);
+
+    handle = NewSparseSet(feeder.nNodes);
+    SetOptions(handle, ReuseNumericFactorization);
+    ReserveSparseSet(handle, res.nnz, res.primitives);
+    TimeRebuild(handle, feeder);
+    res.rebuildReserved = TimeRebuild(handle, feeder);
+    DeleteSparseSet(handle);
+}
+
+// b = Y * x for every primitive, through each mvmult variant; average per sweep
+void TimeMvmult(const BenchOptions& opts, const Feeder& feeder, BenchResult& res)
+{
+    // packed storage, grouped by order as a caller of mvmult_batch would
+    std::vector<const Primitive*> sorted;
+    for (const Primitive& p : feeder.primitives)
+        sorted.push_back(&p);
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Primitive* a, const Primitive* b) { return a->nodes.size() < b->nodes.size(); });
+
+    std::vector<int32_t> orders;
+    std::vector<std::complex<double>> Y, X, B;
+    for (const Primitive* p : sorted)
+    {
+        orders.push_back(int32_t(p->nodes.size()));
+        Y.insert(Y.end(), p->Y.begin(), p->Y.end());
+        for (unsigned int node : p->nodes)
+            X.push_back(std::complex<double>(1.0 + 1e-3 * node, -1e-3 * node));
+    }
+    B.resize(X.size());
+    complex* const pY = reinterpret_cast<complex*>(Y.data());
+    complex* const pX = reinterpret_cast<complex*>(X.data());
+    complex* const pB = reinterpret_cast<complex*>(B.data());
+
+    Clock::time_point start = Clock::now();
+    for (unsigned int r = 0; r < opts.repeat; ++r)
+    {
+        size_t vectorOffset = 0, matrixOffset = 0;
+        for (int32_t N : orders)
+        {
+            mvmult(N, pB + vectorOffset, pY + matrixOffset, pX + vectorOffset);
+            vectorOffset += N;
+            matrixOffset += size_t(N) * N;
+        }
+    }
+    res.mvmultLoop = SecondsSince(start) / opts.repeat;
+
+    start = Clock::now();
+    for (unsigned int r = 0; r < opts.repeat; ++r)
+    {
+        size_t vectorOffset = 0, matrixOffset = 0;
+        for (size_t k = 0; k < orders.size();)
+        {
+            const int32_t N = orders[k];
+            size_t count = 1;
+            while (k + count < orders.size() && orders[k + count] == N)
+                ++count;
+            mvmult_batch(int32_t(count), N, pB + vectorOffset, pY + matrixOffset, pX + vectorOffset);
+            vectorOffset += count * N;
+            matrixOffset += count * N * N;
+            k += count;
+        }
+    }
+    res.mvmultBatch = SecondsSince(start) / opts.repeat;
+
+    start = Clock::now();
+    for (unsigned int r = 0; r < opts.repeat; ++r)
+        mvmult_ragged(int32_t(orders.size()), orders.data(), nullptr, nullptr, pB, pY, pX);
+    res.mvmultRagged = SecondsSince(start) / opts.repeat;
+}
+
+// the same currents, from node voltages to injections, with the kept primitives
+void TimeCurrents(const BenchOptions& opts, const Feeder& feeder, BenchResult& res)
+{
+    void* handle = NewSparseSet(feeder.nNodes);
+    SetOptions(handle, Option_KeepPrimitives);
+    AddFeeder(handle, feeder);
+    std::vector<std::complex<double>> V(feeder.nNodes, std::complex<double>(1, -0.1)), I(feeder.nNodes);
+    const Clock::time_point start = Clock::now();
+    for (unsigned int r = 0; r < opts.repeat; ++r)
+        AccumulatePrimitiveCurrents(handle, reinterpret_cast<complex*>(V.data()), reinterpret_cast<complex*>(I.data()));
+    res.currents = SecondsSince(start) / opts.repeat;
+    DeleteSparseSet(handle);
+}
+
+// ns per product of mvmult_batch, for the kernels supported here
+std::vector<KernelResult> TimeMvmultKernels(const BenchOptions& opts)
+{
+    std::vector<KernelResult> results;
+    for (const auto& k : mvmultKernels)
+    {
+        if (!mvmult_kernels(k.kernels))
+            continue;
+
+        KernelResult res;
+        res.name = k.name;
+        for (size_t o = 0; o < nMvmultOrders; ++o)
+        {
+            // about 256 kB of matrices, to stay in the cache
+            const int32_t N = mvmultOrders[o];
+            const int32_t count = std::max(16, 16384 / (N * N));
+            std::vector<std::complex<double>> A(size_t(count) * N * N), x(size_t(count) * N), b(size_t(count) * N);
+            for (size_t i = 0; i < A.size(); ++i)
+                A[i] = std::complex<double>(1e-3 * double(i % 101), -1e-3 * double(i % 103));
+            for (size_t i = 0; i < x.size(); ++i)
+                x[i] = std::complex<double>(1, 1e-3 * double(i % 7));
+
+            const unsigned int sweeps = opts.repeat * std::max(1, (1 << 18) / count);
+            const Clock::time_point start = Clock::now();
+            for (unsigned int r = 0; r < sweeps; ++r)
+                mvmult_batch(count, N, reinterpret_cast<complex*>(b.data()), reinterpret_cast<complex*>(A.data()), reinterpret_cast<complex*>(x.data()));
+            res.ns[o] = 1e9 * SecondsSince(start) / (double(sweeps) * count);
+        }
+        results.push_back(res);
+    }
+    mvmult_kernels(MvmultKernels_Auto);
+    return results;
+}
+
+BenchResult RunCase(const BenchOptions& opts, unsigned int nNodes)
+{
+    BenchResult res;
+    Feeder feeder = GenerateIslands(nNodes, opts.islands, opts.meshFraction, opts.seed);
+    const unsigned int n = feeder.nNodes;
+
+    res.topology = (opts.meshFraction > 0) ? "meshed" : "radial";
+    res.nodes = n;
+    res.primitives = feeder.primitives.size();
+
+    void* handle = NewSparseSet(n);
+    SetOptions(handle, ReuseNumericFactorization);
+    TimeFactor(handle, feeder, res);
+
+    // a tap change at the substation, keeps the pattern
+    res.refactor = TimeRefactor(handle);
+
+    std::vector<std::complex<double>> B(size_t(n) * opts.nRHS), X(size_t(n) * opts.nRHS);
+    for (size_t k = 0; k < B.size(); ++k)
+        B[k] = std::complex<double>(1e-3 * double(k % 97), -1e-3 * double(k % 89));
+
+    TimeSolves(opts, handle, n, B, X, res);
+    TimeContextSolves(opts, handle, n, B, res);
+    TimeMultiply(opts, handle, n, B, X, res);
+    TimeMatrixAccess(opts, handle, n, res);
+
+    KLUSolveXStats stats;
+    GetStats(handle, &stats);
+    res.kluMemoryPeak = stats.kluMemoryPeak;
+    DeleteSparseSet(handle);
+
+    res.refactorBlocks = TimeBlockRefactor(feeder);
+    TimeParallelRefactor(opts, feeder, res);
+    TimeParallelSolves(opts, feeder, B, X, res);
+    TimeOrderings(feeder, res);
+    TimeRebuilds(feeder, res);
+    TimeMvmult(opts, feeder, res);
+    TimeCurrents(opts, feeder, res);
+    return res;
+}
+
+void PrintCSVHeader(const BenchOptions& opts, const std::vector<KernelResult>& kernels)
+{
+    printf("topology,islands,nodes,primitives,nnz,factor_nnz,flops,add_primitives_s,assembly_s,analyze_s,factor_s,refactor_s,refactor_blocks_s,solve_s,solve_multi_per_rhs_s,rebuild_full_s,rebuild_mapped_s,rebuild_reserved_s,klu_mem_peak_bytes,matrix_bytes,mvmult_loop_s,mvmult_batch_s,mvmult_ragged_s,currents_s,multiply_s,residual_s,matrix_copy_s,matrix_view_s");
+    for (unsigned int nThreads = 1; nThreads <= opts.maxThreads; nThreads *= 2)
+        printf(",context_solves_per_s_%ut", nThreads);
+    for (unsigned int nThreads = 1; nThreads <= opts.maxThreads; nThreads *= 2)
+        printf(",parallel_refactor_s_%ut", nThreads);
+    for (unsigned int nThreads = 1; nThreads <= opts.maxThreads; nThreads *= 2)
+        printf(",parallel_solve_s_%ut", nThreads);
+    for (unsigned int nThreads = 1; nThreads <= opts.maxThreads; nThreads *= 2)
+        printf(",parallel_residual_s_%ut", nThreads);
+    for (size_t k = 0; k < nOrderings; ++k)
+        printf(",factor_nnz_%s,flops_%s,analyze_s_%s,factor_s_%s", orderings[k].name, orderings[k].name, orderings[k].name, orderings[k].name);
+    for (const KernelResult& k : kernels)
+        for (int32_t N : mvmultOrders)
+            printf(",mvmult_ns_%s_%d", k.name, N);
+    printf("\n");
+}
+
+void PrintResult(const BenchOptions& opts, const BenchResult& r, const std::vector<KernelResult>& kernels)
+{
+    if (opts.csv)
+    {
+        printf("%s,%u,%u,%u,%u,%u,%g,%g,%g,%g,%g,%g,%g,%g,%g,%g,%g,%g,%llu,%llu,%g,%g,%g,%g,%g,%g,%g,%g",
+            r.topology, opts.islands, r.nodes, r.primitives, r.nnz, r.factorNNZ, r.flops,
+            r.addPrimitives, r.assembly, r.analyze, r.factor, r.refactor, r.refactorBlocks, r.solve, r.solveMultiPerRHS,
+            r.rebuildFull, r.rebuildMapped, r.rebuildReserved, (unsigned long long)r.kluMemoryPeak, (unsigned long long)r.matrixBytes,
+            r.mvmultLoop, r.mvmultBatch, r.mvmultRagged, r.currents, r.multiply, r.residual, r.matrixCopy, r.matrixView);
+        for (double v : r.contextSolvesPerSecond)
+            printf(",%g", v);
+        for (double v : r.parallelRefactor)
+            printf(",%g", v);
+        for (double v : r.parallelSolve)
+            printf(",%g", v);
+        for (double v : r.parallelResidual)
+            printf(",%g", v);
+        for (const OrderingResult& o : r.ordering)
+            printf(",%u,%g,%g,%g", o.factorNNZ, o.flops, o.analyze, o.factor);
+        for (const KernelResult& k : kernels)
+            for (double v : k.ns)
+                printf(",%g", v);
+        printf("\n");
+    }
+    else
+    {
+        printf("{\"topology\": \"%s\", \"islands\": %u, \"nodes\": %u, \"primitives\": %u, \"nnz\": %u, \"factor_nnz\": %u, \"flops\": %g, "
+               "\"add_primitives_s\": %g, \"assembly_s\": %g, \"analyze_s\": %g, \"factor_s\": %g, \"refactor_s\": %g, \"refactor_blocks_s\": %g, "
+               "\"solve_s\": %g, \"solve_multi_per_rhs_s\": %g, \"nrhs\": %u, \"rebuild_full_s\": %g, \"rebuild_mapped_s\": %g, \"rebuild_reserved_s\": %g, "
+               "\"klu_mem_peak_bytes\": %llu, \"matrix_bytes\": %llu, \"mvmult_loop_s\": %g, \"mvmult_batch_s\": %g, \"mvmult_ragged_s\": %g, \"currents_s\": %g, "
+               "\"multiply_s\": %g, \"residual_s\": %g, \"matrix_copy_s\": %g, \"matrix_view_s\": %g, "
+               "\"context_solves_per_s\": [",
+            r.topology, opts.islands, r.nodes, r.primitives, r.nnz, r.factorNNZ, r.flops,
+            r.addPrimitives, r.assembly, r.analyze, r.factor, r.refactor, r.refactorBlocks,
+            r.solve, r.solveMultiPerRHS, opts.nRHS, r.rebuildFull, r.rebuildMapped, r.rebuildReserved,
+            (unsigned long long)r.kluMemoryPeak, (unsigned long long)r.matrixBytes, r.mvmultLoop, r.mvmultBatch, r.mvmultRagged, r.currents,
+            r.multiply, r.residual, r.matrixCopy, r.matrixView);
+        for (size_t k = 0; k < r.contextSolvesPerSecond.size(); ++k)
+            printf("%s%g", k ? ", " : "", r.contextSolvesPerSecond[k]);
+        printf("], \"parallel_refactor_s\": [");
+        for (size_t k = 0; k < r.parallelRefactor.size(); ++k)
+            printf("%s%g", k ? ", " : "", r.parallelRefactor[k]);
+        printf("], \"parallel_solve_s\": [");
+        for (size_t k = 0; k < r.parallelSolve.size(); ++k)
+            printf("%s%g", k ? ", " : "", r.parallelSolve[k]);
+        printf("], \"parallel_residual_s\": [");
+        for (size_t k = 0; k < r.parallelResidual.size(); ++k)
+            printf("%s%g", k ? ", " : "", r.parallelResidual[k]);
+        printf("], \"orderings\": {");
+        for (size_t k = 0; k < nOrderings; ++k)
+        {
+            const OrderingResult& o = r.ordering[k];
+            printf("%s\"%s\": {\"factor_nnz\": %u, \"flops\": %g, \"analyze_s\": %g, \"factor_s\": %g}",
+                k ? ", " : "", orderings[k].name, o.factorNNZ, o.flops, o.analyze, o.factor);
+        }
+        printf("}, \"mvmult_ns\": {");
+        for (size_t k = 0; k < kernels.size(); ++k)
+        {
+            printf("%s\"%s\": {", k ? ", " : "", kernels[k].name);
+            for (size_t o = 0; o < nMvmultOrders; ++o)
+                printf("%s\"%d\": %g", o ? ", " : "", mvmultOrders[o], kernels[k].ns[o]);
+            printf("}");
+        }
+        printf("}}\n");
+    }
+    fflush(stdout);
+}
+
+std::vector<unsigned int> ParseSizes(const char* arg)
+{
+    std::vector<unsigned int> sizes;
+    const char* p = arg;
+    while (*p)
+    {
+        char* end;
+        const unsigned long v = strtoul(p, &end, 10);
+        if (end == p)
+            break;
+        sizes.push_back(unsigned(v));
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return sizes;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    BenchOptions opts;
+    opts.sizes = { 1000, 10000, 100000 };
+    opts.meshFraction = 0;
+    opts.repeat = 20;
+    opts.maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    opts.nRHS = 16;
+    opts.seed = 1;
+    opts.islands = 1;
+    opts.csv = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const bool hasValue = (i + 1 < argc);
+        if (!strcmp(argv[i], "--sizes") && hasValue)
+            opts.sizes = ParseSizes(argv[++i]);
+        else if (!strcmp(argv[i], "--mesh") && hasValue)
+            opts.meshFraction = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--repeat") && hasValue)
+            opts.repeat = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--threads") && hasValue)
+            opts.maxThreads = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--nrhs") && hasValue)
+            opts.nRHS = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--seed") && hasValue)
+            opts.seed = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--islands") && hasValue)
+            opts.islands = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--csv"))
+            opts.csv = true;
+        else
+        {
+            fprintf(stderr, "Usage: %s [--sizes 1000,10000,100000] [--mesh 0.0] [--repeat 20] [--threads N] [--nrhs 16] [--seed 1] [--islands 1] [--csv]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    const std::vector<KernelResult> kernels = TimeMvmultKernels(opts);
+
+    if (opts.csv)
+        PrintCSVHeader(opts, kernels);
+
+    for (unsigned int nNodes : opts.sizes)
+        PrintResult(opts, RunCase(opts, nNodes), kernels);
+
+    return 0;
+}
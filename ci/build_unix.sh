@@ -13,5 +13,6 @@ mkdir ${KLUSOLVE_WORK_DIR}/klusolve/build
 ln -s SuiteSparse klusolve/build/
 ln -s eigen-${EIGEN_VERSION} klusolve/build/
 cd ${KLUSOLVE_WORK_DIR}/klusolve/build
-cmake -DCMAKE_BUILD_TYPE=Release -DDSS_EXTENSIONS=ON -DUSE_SYSTEM_SUITESPARSE=OFF -DUSE_SYSTEM_EIGEN=OFF ${KLUSOLVE_EXTRA_CMAKE_FLAGS} ..
+cmake -DCMAKE_BUILD_TYPE=Release -DDSS_EXTENSIONS=ON -DUSE_SYSTEM_SUITESPARSE=OFF -DUSE_SYSTEM_EIGEN=OFF -DKLUSOLVEX_BUILD_TESTS=ON ${KLUSOLVE_EXTRA_CMAKE_FLAGS} ..
 cmake --build .
+ctest --output-on-failure
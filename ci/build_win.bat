@@ -47,9 +47,10 @@ mkdir build
 cd build
 
 set path=%ADD_THIS_TO_PATH%;%path%
-echo FULL CMAKE COMMAND LINE: cmake .. -DDSS_EXTENSIONS=ON -DUSE_SYSTEM_SUITESPARSE=OFF -DUSE_SYSTEM_EIGEN=OFF %CMAKE_EXTRA%
-cmake .. -DDSS_EXTENSIONS=ON -DUSE_SYSTEM_SUITESPARSE=OFF -DUSE_SYSTEM_EIGEN=OFF %CMAKE_EXTRA%
-cmake --build . --config Release
+echo FULL CMAKE COMMAND LINE: cmake .. -DDSS_EXTENSIONS=ON -DUSE_SYSTEM_SUITESPARSE=OFF -DUSE_SYSTEM_EIGEN=OFF -DKLUSOLVEX_BUILD_TESTS=ON %CMAKE_EXTRA%
+cmake .. -DDSS_EXTENSIONS=ON -DUSE_SYSTEM_SUITESPARSE=OFF -DUSE_SYSTEM_EIGEN=OFF -DKLUSOLVEX_BUILD_TESTS=ON %CMAKE_EXTRA%
+cmake --build . --config Release || exit /b 1
+ctest -C Release --output-on-failure || exit /b 1
 
 @REM REM Copy dependency DLLs
 @REM cd c:\projects\klusolve
@@ -47,16 +47,156 @@ extern "C"
         ReuseNumericFactorization = 3 // Reuse the numeric factorization, implies ReuseSymbolicFactorization
     };
 
+    // The default format (zero) uses complex float64 values. For the other formats,
+    // the vectors used in the solve functions and the values exported through
+    // GetCompressedMatrix use the respective element type; the matrix input
+    // functions still take complex float64 values, which are converted.
+    // The single-precision formats are factored with Eigen's SparseLU instead
+    // of KLU, so GetRCond, GetRGrowth, GetCondEst and GetFlops return -1.
     enum MatrixFormatFlags {
-        MatrixFormat_DoublePrecisionReal = 32 // The matrix elements are float64, no imaginary part
-        // MatrixFormat_SinglePrecisionComplex = 33, // The matrix elements are complex float32, real and imaginary parts
-        // MatrixFormat_SinglePrecisionReal = 34 // The matrix elements are float32, no imaginary part
+        MatrixFormat_DoublePrecisionReal = 32, // The matrix elements are float64, no imaginary part
+        MatrixFormat_SinglePrecisionComplex = 48, // The matrix elements are complex float32, real and imaginary parts
+        MatrixFormat_SinglePrecisionReal = 64 // The matrix elements are float32, no imaginary part
     };
 
-    // Set KLUSolveX options. Currently restricted to ReuseFlags values.
+    enum OptionFlags {
+        // Keep the compressed matrix pattern across ZeroSparseSet calls. When the
+        // same sequence of AddPrimitiveMatrix calls is repeated, the values are
+        // added directly to the compressed matrix and the symbolic factorization
+        // is reused. Any difference falls back to the full assembly.
+        Option_ReuseAssemblyMap = 0x0100,
+
+        // For the float64 formats, factorize a float32 copy of the matrix (with
+        // Eigen's SparseLU) and refine every solve against the float64 matrix.
+        Option_MixedPrecisionFactor = 0x0200,
+
+        // For the float64 formats, when only the values changed since the last
+        // factorization, keep the previous numeric factorization and refine every
+        // solve against the current matrix. The matrix is refactored only when a
+        // solve does not converge within the limits given in SetRefinementParameters.
+        Option_DeferRefactorization = 0x0400,
+
+        // For the float64 formats, factorize each connected component of the matrix
+        // on its own (for the structurally symmetric Y matrices, these are the blocks
+        // of KLU's block triangular form). Refactorizations only process the blocks
+        // whose values changed. Not used with Option_MixedPrecisionFactor.
+        Option_BlockFactorization = 0x0800,
+
+        // With Option_BlockFactorization, factor the blocks that changed concurrently,
+        // on the number of threads given in SetThreadCount.
+        Option_ParallelFactorization = 0x1000,
+
+        // With Option_BlockFactorization, solve the blocks (the islands of the system)
+        // concurrently, each on its own part of the vectors. Solve contexts are not affected.
+        Option_ParallelSolve = 0x2000,
+
+        // Keep the memory KLU frees for this system (in factorizations, analyses,
+        // refactorizations that fail) in a pool, for its next allocations. The
+        // pool is released with the system or when the option is cleared.
+        Option_PooledKLUMemory = 0x4000,
+
+        // Keep a copy of each matrix given to AddPrimitiveMatrix, with its nodes,
+        // for AccumulatePrimitiveCurrents. Set it before adding the matrices; the
+        // copies are dropped by ZeroSparseSet and when the option is cleared.
+        Option_KeepPrimitives = 0x8000,
+
+        // With Option_KeepPrimitives, compute the currents of AccumulatePrimitiveCurrents
+        // on multiple threads, with the primitive matrices grouped so that no two
+        // in a group share a node.
+        Option_ParallelCurrents = 0x10000,
+
+        // Compute MultiplySparseSet and ResidualSparseSet on multiple threads, by
+        // rows, for the larger systems.
+        Option_ParallelMultiply = 0x20000
+    };
+
+    // Kernels for mvmult_kernels
+    enum MvmultKernels {
+        MvmultKernels_Auto = 0,
+        MvmultKernels_Generic = 1, // Eigen's fixed-size products, for the instruction set of the build
+        MvmultKernels_AVX2 = 2, // x86-64 with AVX2 and FMA
+        MvmultKernels_AVX512 = 3, // x86-64 with AVX-512F
+        MvmultKernels_NEON = 4 // ARM64, in builds with KLUSOLVEX_NEON_KERNELS
+    };
+
+    // Fill-reducing orderings for SetOrdering
+    enum OrderingMethod {
+        Ordering_AMD = 0, // KLU's default, approximate minimum degree on A+A'
+        Ordering_COLAMD = 1, // column approximate minimum degree on A'A
+        Ordering_METIS = 2, // METIS nested dissection on A+A'
+        Ordering_Given = 3 // a permutation supplied by the caller
+    };
+
+    // Timing and counters for one phase of the KLUSolveX process.
+    // Times are wall-clock seconds from a monotonic clock.
+    typedef struct {
+        uint64_t count; // number of calls
+        double totalTime; // cumulative time in all calls
+        double lastTime; // time in the last call
+        uint64_t bytesAllocated; // cumulative memory allocated by this phase
+    } KLUSolveXPhaseStats;
+
+    typedef struct {
+        KLUSolveXPhaseStats assembly; // building the compressed matrix from triplets
+        KLUSolveXPhaseStats analyze; // klu_analyze
+        KLUSolveXPhaseStats factor; // klu_factor
+        KLUSolveXPhaseStats refactor; // klu_refactor
+        KLUSolveXPhaseStats solve; // klu_solve, excluding solves through solve contexts
+
+        uint64_t symbolicReuseHits; // factorizations that reused the symbolic analysis
+        uint64_t symbolicReuseMisses; // factorizations that ran klu_analyze
+        uint64_t numericReuseHits; // refactorizations accepted
+        uint64_t numericReuseMisses; // refactorizations that failed or were rejected
+        uint64_t assemblyMapHits; // rebuilds completed through the assembly map
+        uint64_t assemblyMapMisses; // rebuilds that had to fall back to triplets
+
+        uint64_t kluMemoryUsage; // current memory used by KLU for this system, in bytes
+        uint64_t kluMemoryPeak; // peak memory used by KLU for this system, in bytes
+
+        uint64_t refinementSteps; // iterative refinement corrections, in all solves
+        uint64_t deferredFactorizations; // factorizations skipped with Option_DeferRefactorization
+        uint64_t deferredFallbacks; // solves that had to refactor after a deferred factorization
+
+        uint64_t blocksFactored; // blocks (re)factored with Option_BlockFactorization
+        uint64_t blocksSkipped; // blocks left untouched since their values didn't change
+
+        uint64_t symbolicGiven; // analyses that used the ordering from LoadSymbolic
+
+        uint64_t kluPoolBytes; // memory held by the pool of Option_PooledKLUMemory, in use or cached
+        uint64_t kluPoolPeak; // peak of kluPoolBytes
+        uint64_t kluPoolHits; // KLU allocations served from cached blocks
+        uint64_t kluPoolMisses; // KLU allocations that had to allocate memory
+    } KLUSolveXStats;
+
+    // Read-only view of the compressed (CSC) matrix, see GetCompressedMatrixView.
+    typedef struct {
+        uint64_t version; // matrix version the arrays belong to, see GetMatrixVersion
+        uint32_t n; // number of rows and columns
+        uint32_t nnz; // number of entries
+        uint32_t entrySize; // size in bytes of each value
+        uint32_t dataFormat; // MatrixFormatFlags value, zero for complex float64
+        const int32_t* pColP; // n + 1 zero-based column starts
+        const int32_t* pRowIdx; // nnz zero-based rows, ascending in each column
+        const void* pValues; // nnz values, in the element type of the matrix format
+    } KLUSolveXMatrixView;
+
+    // Set KLUSolveX options. The lowest 4 bits are a ReuseFlags value, the next
+    // 4 bits a MatrixFormatFlags value (or zero), and higher bits OptionFlags.
     // Other bits reserved for future use.
     void KLUSOLVEX_STDCALL SetOptions(void* handle, uint64_t opts);
 
+    // Thresholds to validate the numeric refactorization used with
+    // ReuseNumericFactorization. If, after klu_refactor, the reciprocal condition
+    // estimate (see GetRCond) is below minRCond or the reciprocal pivot growth
+    // (see GetRGrowth) is below minRGrowth, a full numeric factorization is run
+    // instead. Use zero to disable each check (default).
+    // return 1 if successful, 0 if not
+    int KLUSOLVEX_STDCALL SetRefactorThresholds(void* handle, double minRCond, double minRGrowth);
+
+    // Number of refactorizations accepted (fast path) and rejected by the thresholds.
+    // return 1 if successful, 0 if not
+    int KLUSOLVEX_STDCALL GetRefactorCounts(void* handle, uint64_t* pAccepted, uint64_t* pRejected);
+
     // return handle of new sparse set, 0 if error
     // be sure to DeleteSparseSet using the returned handle
     void* KLUSOLVEX_STDCALL NewSparseSet(unsigned int nBus);
@@ -74,10 +214,118 @@ extern "C"
 	*/
     // return 1 if successful, 2 if singular, 0 if other error
     int KLUSOLVEX_STDCALL SolveSparseSet(void* handle, complex* acxX, complex* acxB);
+
+    /*
+    input: current injections in zero-based acxXB
+    output: node voltages in zero-based acxXB, overwriting the injections
+    */
+    // return 1 if successful, 2 if singular, 0 if other error
+    int KLUSOLVEX_STDCALL SolveSparseSetInPlace(void* handle, complex* acxXB);
+
+    /*
+    Same as SolveSparseSet, for nRHS right-hand sides at once.
+    acxB and acxX are column-major blocks of nRHS columns, each column
+    starting ldb elements after the previous one (ldb >= system size).
+    acxX may be the same buffer as acxB.
+    */
+    // return 1 if successful, 2 if singular, 0 if other error
+    int KLUSOLVEX_STDCALL SolveSparseSetMulti(void* handle, unsigned int nRHS, complex* acxX, complex* acxB, unsigned int ldb);
     
+    /*
+    Solves for a sparse right-hand side, computing only the requested entries of
+    the solution: nnzB entries valB at the zero-based rows idxB (repeated rows are
+    summed), nOut solution entries written to valOut for the zero-based idxOut.
+    Values use the element type of the matrix format, as in SolveSparseSet.
+    With a KLU factorization, only the parts of the factors reachable from the
+    right-hand side and the outputs are traversed. Otherwise (single-precision
+    formats, Option_MixedPrecisionFactor, Option_BlockFactorization or a
+    deferred factorization), this falls back to a full solve.
+    */
+    // return 1 if successful, 2 if singular, 0 if other error (e.g. an index out of range)
+    int KLUSOLVEX_STDCALL SolveSparseRHS(void* handle, unsigned int nnzB, unsigned int* idxB, complex* valB, unsigned int nOut, unsigned int* idxOut, complex* valOut);
+
     // return 1 if successful, 0 if not
     int KLUSOLVEX_STDCALL DeleteSparseSet(void* handle);
 
+    /*
+    Solve contexts allow multiple threads to solve concurrently against the
+    factorization of a single sparse set, one context per thread. The sparse
+    set must be factored before solving with a context, and must not be
+    modified, refactored or deleted while its contexts are solving. A context
+    picks up a new factorization automatically on its next solve.
+    */
+    // return handle of new solve context, 0 if error
+    void* KLUSOLVEX_STDCALL NewSolveContext(void* handle);
+
+    // return 1 if successful, 2 if the sparse set is not factored, 3 if the
+    // refinement did not converge, 0 if other error
+    int KLUSOLVEX_STDCALL SolveSparseSetWithContext(void* hContext, complex* acxX, complex* acxB);
+
+    // return 1 if successful, 0 if not
+    int KLUSOLVEX_STDCALL DeleteSolveContext(void* hContext);
+
+    /*
+    Limits for the iterative refinement used with Option_MixedPrecisionFactor and
+    Option_DeferRefactorization. A solve stops when the normwise backward error,
+    max|B - A*X| / (|A| * max|X| + max|B|) with |A| the largest absolute column sum,
+    is below tolerance, or after maxIterations corrections.
+    Defaults: 10 iterations, tolerance 1e-14.
+    */
+    // return 1 if successful, 0 if not
+    int KLUSOLVEX_STDCALL SetRefinementParameters(void* handle, unsigned int maxIterations, double tolerance);
+
+    /*
+    Refinement results of the last solve through the handle (for multiple right-hand
+    sides, the worst column). Both are zero if the last solve was not refined.
+    A solve context doesn't refactor the shared system; SolveSparseSetWithContext
+    returns 3 if its refinement doesn't converge.
+    */
+    // return 1 if successful, 0 if not
+    int KLUSOLVEX_STDCALL GetRefinementInfo(void* handle, unsigned int* pIterations, double* pResidual);
+
+    /*
+    Adds the changes in pValues to the existing (1-based) entries [pRows[k], pCols[k]]
+    without refactoring: the next solves use the current factorization with a dense
+    correction (Sherman-Morrison-Woodbury), which grows with the number of distinct
+    changed columns. Once that exceeds the limit from SetLowRankLimit (default 32),
+    the system is refactored on the next solve instead.
+    The updates are absorbed by the next factorization. Only for the float64 formats,
+    without Option_MixedPrecisionFactor, Option_BlockFactorization or a deferred
+    factorization.
+    */
+    // return 1 if successful, 2 if the system will be refactored, 0 if not supported
+    // or an entry is not in the matrix (nothing is changed in that case)
+    int KLUSOLVEX_STDCALL AddLowRankUpdate(void* handle, unsigned int n, unsigned int* pRows, unsigned int* pCols, complex* pValues);
+
+    // Reverts the matrix values changed by AddLowRankUpdate since the last factorization
+    // return 1 if successful, 0 if not
+    int KLUSOLVEX_STDCALL ClearLowRankUpdates(void* handle);
+
+    // return 1 if successful, 0 if not
+    int KLUSOLVEX_STDCALL SetLowRankLimit(void* handle, unsigned int maxRank);
+
+    /*
+    Number of threads used with Option_ParallelFactorization,
+    Option_ParallelSolve, Option_ParallelCurrents and Option_ParallelMultiply,
+    including the calling thread. Zero (default) uses the number of hardware
+    threads. With multiple threads, the factorization phase times in GetStats
+    add up the time spent in each thread.
+    */
+    // return 1 if successful, 0 if not
+    int KLUSOLVEX_STDCALL SetThreadCount(void* handle, unsigned int nThreads);
+
+    /*
+    Sizes the matrix assembly for about expectedNNZ non-zeros in the compressed
+    matrix and expectedPrimitives AddPrimitiveMatrix calls (3-phase elements are
+    assumed), either can be zero. From then on, the triplets and the compressed
+    matrix keep their storage across ZeroSparseSet calls, so rebuilding a system
+    of the same size doesn't allocate memory; the assembly bytesAllocated in
+    GetStats only counts the growth. Zero for both releases the buffers after
+    the next use, as by default.
+    */
+    // return 1 if successful, 0 if not
+    int KLUSOLVEX_STDCALL ReserveSparseSet(void* handle, unsigned int expectedNNZ, unsigned int expectedPrimitives);
+
     /* i and j are 1-based for these */
     // return 1 if successful, 0 if not
     int KLUSOLVEX_STDCALL AddMatrixElement(void* handle, unsigned int i, unsigned int j, complex* pcxVal);
@@ -95,17 +343,161 @@ extern "C"
     int KLUSOLVEX_STDCALL GetFlops(void* handle, double* pResult);
     int KLUSOLVEX_STDCALL GetSingularCol(void* handle, unsigned int* pResult);
 
+    // Copies the timing and counters of the sparse set to pStats.
+    // The counters are kept for the lifetime of the handle, unless reset with ResetStats.
+    // return 1 if successful, 0 if not
+    int KLUSOLVEX_STDCALL GetStats(void* handle, KLUSolveXStats* pStats);
+    int KLUSOLVEX_STDCALL ResetStats(void* handle);
+
     int KLUSOLVEX_STDCALL AddPrimitiveMatrix(void* handle, unsigned int nOrder, unsigned int* pNodes, complex* pcY);
     int KLUSOLVEX_STDCALL GetCompressedMatrix(void* handle, unsigned int nColP, unsigned int nNZ, unsigned int* pColP, unsigned int* pRowIdx, complex* pcY);
     int KLUSOLVEX_STDCALL GetTripletMatrix(void* handle, unsigned int nNZ, unsigned int* pRows, unsigned int* pCols, complex* pcY);
+
+    /*
+    Same arrays as GetCompressedMatrix, borrowed instead of copied: the view
+    points to the storage of the sparse set. Pending changes are assembled
+    first. The arrays remain valid only while GetMatrixVersion returns the
+    version of the view; any change to the matrix (AddPrimitiveMatrix,
+    AddMatrixElement, IncrementMatrixElement, ZeroSparseSet, a new format in
+    SetOptions, etc.) or DeleteSparseSet invalidates them. Factorizations and
+    solves don't change the matrix. The arrays must not be written to.
+    */
+    // return 1 if successful, 0 if not
+    int KLUSOLVEX_STDCALL GetCompressedMatrixView(void* handle, KLUSolveXMatrixView* pView);
+
+    // Current version of the matrix, incremented on every change to its values or pattern.
+    // return 1 if successful, 0 if not
+    int KLUSOLVEX_STDCALL GetMatrixVersion(void* handle, uint64_t* pVersion);
     int KLUSOLVEX_STDCALL FindIslands(void* handle, unsigned int nOrder, unsigned int* pNodes);
 
     int KLUSOLVEX_STDCALL IncrementMatrixElement(void* handle, unsigned int i, unsigned int j, double re, double im);
     int KLUSOLVEX_STDCALL ZeroiseMatrixElement(void* handle, unsigned int i, unsigned int j);
+
+    /*
+    Slot handles for IncrementMatrixElements and ZeroiseMatrixElements.
+    pRows and pCols are 1-based; the slot of an element not present in the
+    compressed matrix is set to -1. pVersion receives the version of the
+    sparsity pattern the slots were resolved for, to be passed along with
+    them. Once the pattern changes (ZeroSparseSet without
+    Option_ReuseAssemblyMap, AddPrimitiveMatrix, AddMatrixElement with a new
+    entry, etc.), the slots are rejected and must be requested again.
+    */
+    // return 1 if all elements were found, 0 if not
+    int KLUSOLVEX_STDCALL GetMatrixElementSlots(void* handle, unsigned int n, unsigned int* pRows, unsigned int* pCols, int32_t* pSlots, uint64_t* pVersion);
+
+    // Same as calling IncrementMatrixElement/ZeroiseMatrixElement for each slot.
+    // return 1 if successful, 0 if not (e.g. invalid slot, or version is not the
+    // current one; nothing is changed in that case)
+    int KLUSOLVEX_STDCALL IncrementMatrixElements(void* handle, unsigned int n, int32_t* pSlots, complex* pValues, uint64_t version);
+    int KLUSOLVEX_STDCALL ZeroiseMatrixElements(void* handle, unsigned int n, int32_t* pSlots, uint64_t version);
     int KLUSOLVEX_STDCALL SaveAsMarketFiles(void* handle, const char* fileNameMatrix, const double *b, const char* fileNameVector);
 
+    /*
+    Binary alternative to SaveAsMarketFiles for large systems: writes the
+    compressed matrix, the options (including the matrix format) and, if not
+    null, the right-hand side b and the solution x, in the element type of the
+    format, to a single file for the same platform. Pending changes are included
+    without compressing the system's matrix.
+    */
+    // return 1 if successful, 0 if not
+    int KLUSOLVEX_STDCALL SaveSnapshot(void* handle, const char* path, const double* b, const double* x);
+
+    // Creates a sparse set from a snapshot. The file is memory-mapped and the
+    // compressed arrays are copied as they are, without parsing or assembly.
+    // return the new handle, or null if the file is not a valid snapshot
+    void* KLUSOLVEX_STDCALL NewSparseSetFromSnapshot(const char* path);
+
+    // Copies the vectors saved in a snapshot of a system with n nodes. b or x
+    // can be null to skip them.
+    // return 1 if successful, 0 if the file is invalid or a requested vector was not saved
+    int KLUSOLVEX_STDCALL ReadSnapshotVectors(const char* path, unsigned int n, double* b, double* x);
+
+    /*
+    Saves the fill-reducing ordering and block structure of the current symbolic
+    analysis (factoring first if needed), with a fingerprint of the sparsity pattern,
+    to a binary file for the same platform. Not available for the single-precision
+    formats, Option_MixedPrecisionFactor or Option_BlockFactorization.
+    */
+    // return 1 if successful, 0 if not
+    int KLUSOLVEX_STDCALL SaveSymbolic(void* handle, const char* path);
+
+    /*
+    Loads an ordering saved with SaveSymbolic. While the sparsity pattern matches
+    the saved fingerprint, the symbolic analyses use it (klu_analyze_given) instead
+    of computing a new ordering. The file is checked, but the pattern can only be
+    compared at the next factorization; GetStats counts the matches in symbolicGiven.
+    */
+    // return 1 if successful, 0 if the file is invalid or for a different system size
+    int KLUSOLVEX_STDCALL LoadSymbolic(void* handle, const char* path);
+
+    /*
+    Selects the fill-reducing ordering used by the next symbolic analyses (an
+    OrderingMethod value). For Ordering_Given, pPerm is a zero-based permutation
+    of the n nodes, applied symmetrically: node pPerm[k] is the k-th to be
+    eliminated. KLU still finds the blocks of the block triangular form, and
+    each block keeps the relative order of its nodes in pPerm. An ordering
+    from LoadSymbolic takes precedence while its pattern matches. The current
+    factorization is discarded. Not used by the single-precision formats or
+    Option_MixedPrecisionFactor, which are factored with Eigen's SparseLU.
+    */
+    // return 1 if successful, 0 for an invalid method or permutation
+    int KLUSOLVEX_STDCALL SetOrdering(void* handle, unsigned int method, unsigned int n, int32_t* pPerm);
+
     void KLUSOLVEX_STDCALL mvmult(int32_t N, complex* b, complex* A, complex* x);
 
+    /*
+    Same as mvmult for count elements of order N in one call: A holds the count
+    column-major N x N matrices one after the other, x and b the count vectors.
+    */
+    void KLUSOLVEX_STDCALL mvmult_batch(int32_t count, int32_t N, complex* b, complex* A, complex* x);
+
+    /*
+    Same as mvmult_batch for elements of different orders, pN[k] for element k.
+    Element k uses b and x from pVectorOffsets[k] and A from pMatrixOffsets[k]
+    (in complex values); without an offsets array, the vectors or matrices are
+    stored one after the other. Runs of elements with the same order and
+    consecutive storage are multiplied together, so grouping them pays off.
+    */
+    void KLUSOLVEX_STDCALL mvmult_ragged(int32_t count, int32_t* pN, int32_t* pVectorOffsets, int32_t* pMatrixOffsets, complex* b, complex* A, complex* x);
+
+    /*
+    Selects the kernels used by mvmult, mvmult_batch and mvmult_ragged for the
+    orders 1, 2, 3, 4, 6 and 8 (a MvmultKernels value). By default, the best
+    kernels supported by the CPU are picked on the first call, as with
+    MvmultKernels_Auto. The setting is global to the process.
+    */
+    // return the kernels in use, or 0 if the kernels requested aren't supported by this CPU or build
+    int32_t KLUSOLVEX_STDCALL mvmult_kernels(int32_t kernels);
+
+    /*
+    Adds the currents of the primitive matrices kept with Option_KeepPrimitives
+    to acxI, in a single pass: for each matrix, Yprim * V over its nodes, with
+    the node voltages from the zero-based acxV (ground is zero), each current
+    added to the entry of its node (ground currents are dropped). Values use the
+    element type of the matrix format, as in SolveSparseSet; the real formats
+    use the real part of the primitive matrices, as in the assembled matrix.
+    Changes made with other functions (IncrementMatrixElement...) are not included.
+    */
+    // return 1 if successful, 0 if the primitive matrices are not kept
+    int KLUSOLVEX_STDCALL AccumulatePrimitiveCurrents(void* handle, complex* acxV, complex* acxI);
+
+    /*
+    Product of the current matrix by acxX, in acxY (zero-based vectors, in the
+    element type of the matrix format, as in SolveSparseSet). The output must not
+    overlap acxX. Pending changes are assembled first; the factorization is not
+    used nor changed.
+    */
+    // return 1 if successful, 0 if not
+    int KLUSOLVEX_STDCALL MultiplySparseSet(void* handle, complex* acxX, complex* acxY);
+
+    /*
+    Residual of acxX as a solution for the current matrix, acxR = acxB - Y * acxX,
+    as in MultiplySparseSet. acxR may be acxB. If pNorm is not null, it receives
+    the largest absolute value in acxR.
+    */
+    // return 1 if successful, 0 if not
+    int KLUSOLVEX_STDCALL ResidualSparseSet(void* handle, complex* acxX, complex* acxB, complex* acxR, double* pNorm);
+
     int32_t KLUSOLVEX_STDCALL klusolve_metis(
         int32_t *sorted_edge_pairs, // ([v1 v2] [v1 v3]) ...
         int32_t *edge_weights,
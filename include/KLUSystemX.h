@@ -10,7 +10,19 @@
 #define DSS_EXTENSIONS_KLUSYSTEMX_H
 
 #include "KLUSolveX.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <Eigen/LU>
 #include <Eigen/SparseCore>
+#include <Eigen/SparseLU>
 #include "klu.h"
 
 namespace KLUSolveX {
@@ -27,6 +39,140 @@ struct matrix_complex
     }
 };
 
+// Measures the wall time of a phase, recorded on destruction
+class PhaseTimer
+{
+public:
+    PhaseTimer(KLUSolveXPhaseStats& stats_)
+        : stats(stats_)
+        , start(std::chrono::steady_clock::now())
+    {
+    }
+    ~PhaseTimer()
+    {
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ++stats.count;
+        stats.lastTime = elapsed;
+        stats.totalTime += elapsed;
+    }
+
+protected:
+    KLUSolveXPhaseStats& stats;
+    std::chrono::steady_clock::time_point start;
+};
+
+/* Fixed set of threads for the parallel factorization. Run() calls
+fn(task, worker) for each task in [0, nTasks), with the tasks taken in order
+by the worker threads and the calling thread (worker 0), and returns when all
+of them are done. Only one Run() at a time.
+*/
+class WorkerPool
+{
+public:
+    typedef std::function<void(size_t, unsigned int)> TaskFn;
+
+    explicit WorkerPool(unsigned int nWorkers);
+    ~WorkerPool();
+
+    // number of workers, including the calling thread
+    unsigned int GetSize() const
+    {
+        return threads.size() + 1;
+    }
+    void Run(size_t nTasks, const TaskFn& fn);
+
+protected:
+    void RunTasks(unsigned int worker);
+    void WorkerLoop(unsigned int worker);
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const TaskFn* job;
+    size_t nTasks;
+    std::atomic<size_t> nextTask;
+    unsigned int nBusy; // worker threads still running the current job
+    uint64_t generation; // incremented for each job
+    bool stopping;
+};
+
+/* Pool for the memory KLU allocates for a system, with Option_PooledKLUMemory.
+The blocks KLU frees are kept by size class for its next allocations, instead
+of going back to the heap. KLU allocates through the SuiteSparse memory
+functions, which are global: they are replaced once, and use the pool of the
+system whose KLU calls are running on the current thread (see KLUMemoryScope),
+or the previous functions otherwise.
+*/
+class KLUMemoryPool
+{
+public:
+    KLUMemoryPool();
+    ~KLUMemoryPool();
+
+    void* Allocate(size_t size);
+    // return false if the block is not from this pool
+    bool Release(void* p);
+    // size available in a block of this pool, 0 if not from this pool
+    size_t GetBlockSize(void* p);
+    // frees the cached blocks
+    void Trim();
+    void SetPooling(bool enable);
+    // fills the kluPool fields
+    void GetStats(KLUSolveXStats& stats);
+    void ResetCounters();
+
+protected:
+    void TrimLocked();
+
+    std::mutex mutex;
+    std::unordered_map<void*, size_t> blocks; // in use, with their size class
+    std::map<size_t, std::vector<void*> > cached; // free blocks by size class
+    size_t usedBytes, cachedBytes, peakBytes;
+    uint64_t hits, misses;
+    bool pooling;
+};
+
+/* Correction for changes to the matrix values after the factorization, using
+the Sherman-Morrison-Woodbury formula. With dA = U * V^T, V selecting the
+changed columns and U holding their changes:
+
+inv(A + dA) = inv(A) - W * inv(I + V^T * W) * V^T * inv(A), with W = inv(A) * U
+*/
+template <typename Scalar>
+struct LowRankCorrection
+{
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> DenseMatrix;
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+
+    std::vector<uint32_t> cols; // changed columns, zero-based
+    DenseMatrix W; // n x cols.size()
+    Eigen::PartialPivLU<DenseMatrix> K; // capacitance matrix, I + V^T * W
+
+    void Clear()
+    {
+        cols.clear();
+        W.resize(0, 0);
+    }
+
+    // input: solutions of the factored system, output: solutions of the modified system
+    void Apply(Scalar* pX, unsigned int nRHS, unsigned int ldim) const
+    {
+        if (cols.empty())
+            return;
+
+        Vector t(cols.size());
+        for (unsigned int c = 0; c < nRHS; ++c)
+        {
+            Scalar* x = pX + size_t(ldim) * c;
+            for (size_t k = 0; k < cols.size(); ++k)
+                t[k] = x[cols[k]];
+
+            const Vector y = K.solve(t);
+            Eigen::Map<Vector>(x, W.rows()) -= W * y;
+        }
+    }
+};
+
 /* Kron reduction not supported, this version just solves
 
 |Y22| * |V| = |I|
@@ -43,6 +189,10 @@ public:
     typedef Eigen::SparseMatrix<float> SparseMatrixF32;
     typedef Eigen::SparseMatrix<std::complex<float>> SparseMatrixC64;
 
+    // KLU only supports float64 values, the single-precision formats use Eigen's LU
+    typedef Eigen::SparseLU<SparseMatrixF32, Eigen::COLAMDOrdering<int> > SparseLUF32;
+    typedef Eigen::SparseLU<SparseMatrixC64, Eigen::COLAMDOrdering<int> > SparseLUC64;
+
     // admittance matrix blocks in compressed-column storage, like Matlab
     SparseMatrix spmat;
     SparseMatrixF64 spmat_f64;
@@ -52,10 +202,129 @@ public:
     std::vector<Eigen::Triplet<complex> > triplets;
     std::vector<complex> acx;
 
+    // sizes from ReserveSparseSet, zero if not given; with either, the triplets and
+    // the compressed matrix keep their storage across assemblies
+    uint32_t reserveNNZ, reservePrimitives;
+    std::vector<int32_t> assemblyWork; // column positions and row marks for the assembly
+
+    // assembly map, used with Option_ReuseAssemblyMap
+    enum AssemblyMapState
+    {
+        AsmMap_None, // not in use or invalidated
+        AsmMap_Recording, // primitive matrices are being recorded, CSC matrix not built yet
+        AsmMap_Ready, // asmSlots matches the current CSC pattern
+        AsmMap_Replaying // after zero(), values are being added directly to the CSC matrix
+    };
+    AssemblyMapState asmState;
+    std::vector<uint32_t> asmNodes; // for each primitive matrix, its order followed by its nodes
+    std::vector<int32_t> asmSlots; // for each primitive matrix entry, the CSC value index (-1 if none)
+    size_t asmNodesPos, asmSlotsPos; // replay position
+
+    // primitive matrices kept with Option_KeepPrimitives, one after the other
+    std::vector<uint32_t> primNodes;
+    std::vector<complex> primValues; // column-major
+    std::vector<int32_t> primOrders, primNodeOffsets, primValueOffsets; // for each primitive matrix
+    // primitive matrices by color for Option_ParallelCurrents, no node is shared
+    // within a color; the last range holds the ones left for a sequential pass
+    std::vector<uint32_t> primColorOrder;
+    std::vector<size_t> primColorStarts; // range of each color in primColorOrder, plus the end
+    bool primColored; // the colors match the primitive matrices
+
+    // buffers for AccumulatePrimitiveCurrents, one per worker
+    struct CurrentsWork
+    {
+        std::vector<int32_t> orders, valueOffsets;
+        std::vector<complex> x, y;
+    };
+    std::vector<CurrentsWork> currentsWork;
+    bool samePattern; // the CSC pattern is known to be unchanged since the last symbolic factorization
+    uint64_t patternVersion; // incremented whenever the CSC pattern may have changed, slots carry it
+    uint64_t factorPatternVersion; // patternVersion last seen by Factor
+    // incremented whenever the values or the storage of the matrix may have changed,
+    // pattern changes included; see GetCompressedMatrixView
+    uint64_t matrixVersion;
+    uint64_t factorMatrixVersion; // matrixVersion last seen by Factor
+
+    // row-wise index of the CSC pattern, for the products with Option_ParallelMultiply
+    struct RowPattern
+    {
+        uint64_t patternVersion; // version of the pattern it was built from
+        std::vector<int32_t> rowStart; // n + 1
+        std::vector<int32_t> cols, slots; // column and CSC value index of each entry, by row
+    };
+    RowPattern rowPattern;
+
     klu_symbolic* Symbolic;
     klu_numeric* Numeric;
     klu_common Common;
 
+    // a connected component of the matrix, factored on its own with Option_BlockFactorization
+    struct FactorBlock
+    {
+        std::vector<uint32_t> nodes; // zero-based rows/columns in the system, ascending
+        std::vector<int> Ap, Ai; // local compressed pattern
+        std::vector<int32_t> slots; // for each local value, its index in the system's CSC values
+        std::vector<double> Ax; // local values, interleaved real/imag for complex
+        klu_symbolic* Symbolic;
+        klu_numeric* Numeric;
+        int32_t singularCol; // local column found singular, -1 if none
+    };
+    std::vector<FactorBlock> factorBlocks;
+    std::vector<uint32_t> blocksBySize; // block indices, largest first
+    std::vector<double> blockWork;
+    std::vector<std::vector<double> > workerBlockWork; // one per worker, with Option_ParallelSolve
+
+    // threads for Option_ParallelFactorization and Option_ParallelSolve, created on first use
+    unsigned int nThreads; // 0 for the number of hardware threads
+    std::unique_ptr<WorkerPool> workerPool;
+
+    // memory for KLU with Option_PooledKLUMemory, kept once created since it may own blocks
+    std::unique_ptr<KLUMemoryPool> kluPool;
+
+    // copy of the KLU factors in compressed form, used by SolveSparseRHS
+    struct ExtractedFactors
+    {
+        bool valid;
+        uint64_t factorVersion; // factorization these were extracted from
+        std::vector<int> Lp, Li, Up, Ui, Fp, Fi; // factored (permuted) indices
+        std::vector<complex> Lx, Ux, Fx; // values, also complex for the real format
+        std::vector<int> Udiag; // position of the diagonal in each column of U
+        std::vector<int> Ltp, Lti, Utp, Uti, Ftp, Fti; // row-wise patterns of the factors
+        std::vector<int> Pinv, Qinv; // original row/column to factored index
+        std::vector<int> blockOf; // BTF block of each factored index
+        std::vector<double> Rs; // row scale factors, by original row
+    };
+    ExtractedFactors sparseFactors;
+
+    // workspace for SolveSparseRHS, by factored index; a mark is set only if equal to stamp
+    struct SparseSolveWork
+    {
+        uint32_t stamp;
+        std::vector<complex> x;
+        std::vector<uint32_t> nonZero; // x holds a value
+        std::vector<uint32_t> neededX, neededY; // solution/forward solve value needed for the outputs
+        std::vector<uint32_t> reachedL, reachedU; // visited in the searches through L/U
+        std::vector<int> pendingX, pendingY, seeds, stack, pos, order;
+    };
+    SparseSolveWork sparseWork;
+
+    // ordering from LoadSymbolic, used by AnalyzeSymbolic while the pattern matches
+    struct GivenOrdering
+    {
+        uint32_t n;
+        uint64_t patternHash;
+        std::vector<int> P, Q; // empty if none
+        std::vector<int> R; // block boundaries, nblocks + 1 entries
+    };
+    GivenOrdering givenOrdering;
+
+    // fill-reducing ordering from SetOrdering
+    unsigned int orderingMethod; // OrderingMethod
+    std::vector<int> orderingPerm, orderingRank; // Ordering_Given: node of each position, position of each node
+
+    std::unique_ptr<SparseLUF32> lu_f32;
+    std::unique_ptr<SparseLUC64> lu_c64;
+
     uint32_t m_nBus; // number of nodes
     uint32_t m_nX; // number of unknown voltages, hardwired to m_nBus
     uint32_t m_NZpre; // number of non-zero entries before factoring
@@ -67,23 +336,112 @@ public:
     void ZeroIndices();
     void NullPointers();
     void ProcessTriplets();
+    // compresses the matrix after insertions by AddElement, before its CSC arrays are used
+    void CompressMatrix();
+    bool KeepsAssemblyBuffers() const { return reserveNNZ || reservePrimitives; }
+    // entries reserved for the triplets and the compressed matrix before the duplicates are summed
+    size_t GetAssemblyReserve() const;
+    void ClearAssemblyMap();
+    void RecordPrimitiveMatrix(unsigned int nOrder, unsigned int* pNodes);
+    bool ReplayPrimitiveMatrix(unsigned int nOrder, unsigned int* pNodes, complex* pMat);
+    void AbandonAssemblyMap();
+    void BuildAssemblySlots();
+    void KeepPrimitive(unsigned int nOrder, const unsigned int* pNodes, const complex* pMat);
+    void ColorPrimitives();
+    template <typename T>
+    void AccumulateCurrentsRange(const uint32_t* prims, size_t count, const T* pV, T* pI, CurrentsWork& work) const;
+    template <typename T>
+    void AccumulateCurrents(const T* pV, T* pI);
+
+    // returns the index of the zero-based [iRow, iCol] in the CSC values, -1 if not present
+    int32_t FindValueIndex(unsigned int iRow, unsigned int iCol);
  
     KLUSystemX();
     KLUSystemX(unsigned int nBus, unsigned int nV = 0, unsigned int nI = 0);
     ~KLUSystemX();
 
     uint64_t options; // KLUSolveX options, currently limited to values in enum ReuseFlags
+    uint64_t flags; // values from enum OptionFlags
     uint32_t dataFormat;
     
     bool bFactored; //  system has been factored
     bool reuseSymbolic; // current state, actual reuse depends on options
+    uint64_t factorVersion; // incremented every time Numeric is (re)computed
+
+    // stability guard for klu_refactor, a threshold <= 0 disables the respective check
+    double minRefactorRCond;
+    double minRefactorRGrowth;
+    uint64_t nRefactorAccepted; // number of refactorizations that passed the checks
+    uint64_t nRefactorRejected; // number of refactorizations replaced by a full numeric factorization
+
+    // iterative refinement, see SetRefinementParameters
+    unsigned int maxRefinementIterations;
+    double refinementTolerance;
+    unsigned int lastRefinementIterations; // results of the last solve
+    double lastRefinementResidual;
+    bool staleFactorization; // factorization was deferred, it doesn't match the current values
+    std::vector<complex> refineWork;
+
+    // low-rank updates since the last factorization, see AddLowRankUpdate
+    struct LowRankEntry
+    {
+        int32_t slot; // index in the CSC values
+        uint32_t row, col; // zero-based
+        complex delta;
+    };
+    std::vector<LowRankEntry> lrEntries;
+    uint64_t lrPatternVersion; // pattern version of the slots in lrEntries
+    uint32_t maxLowRank; // number of changed columns that forces a refactorization
+    LowRankCorrection<complex> lrComplex;
+    LowRankCorrection<double> lrReal;
+
+    KLUSolveXStats stats;
+    void GetStats(KLUSolveXStats* pStats);
+    void ResetStats();
+
+    bool IsSinglePrecision() const
+    {
+        return dataFormat == MatrixFormat_SinglePrecisionComplex || dataFormat == MatrixFormat_SinglePrecisionReal;
+    }
+    // true if the factorization is done by Eigen's SparseLU instead of KLU
+    bool UsesSparseLU() const
+    {
+        return IsSinglePrecision() || (flags & Option_MixedPrecisionFactor);
+    }
+    // true if the matrix is factored in blocks, see Option_BlockFactorization
+    bool UsesBlockFactorization() const
+    {
+        return (flags & Option_BlockFactorization) && !UsesSparseLU();
+    }
+    // true if the solves must be refined against the matrix
+    bool IsRefinementRequired() const
+    {
+        return !IsSinglePrecision() && ((flags & Option_MixedPrecisionFactor) || staleFactorization);
+    }
+    // size in bytes of each element in the solution and right-hand side vectors
+    size_t GetEntrySize() const;
+    // true if there is a numeric factorization to solve with
+    bool HasFactorization() const;
+    // returns the compressed pattern of the current matrix, false if not compressed
+    bool GetPattern(const int*& Ap, const int*& Ai);
+    // fingerprint of the compressed pattern, see SaveSymbolic
+    uint64_t GetPatternHash();
 
     int FactorSystem();
     void SolveSystem(complex* acxX, complex* acxB);
+    // input: current injections in acxXB, output: voltages in acxXB (no copies)
+    void SolveSystemInPlace(complex* acxXB);
+    // solves nRHS right-hand sides (column-major, leading dimension ldim) in a single pass
+    // return 1 for success, 0 for invalid dimensions
+    int SolveSystemMulti(unsigned int nRHS, complex* acxX, complex* acxB, unsigned int ldim);
     
     // this resets and reinitializes the sparse matrix, nI = nBus
     int Initialize(unsigned int nBus, unsigned int nV = 0, unsigned int nI = 0);
 
+    // sets options, flags and data format, reinitializing or dropping the
+    // factorization as needed
+    void SetOptions(uint64_t opts);
+
     uint32_t GetSize() { return m_nBus; }
 
     // metrics
@@ -110,12 +468,61 @@ public:
 
     // returns 1 for success, -1 for a singular matrix
     // returns 0 for another KLU error, most likely the matrix is too large for int32
-    int Factor();
+    // allowDeferral: with Option_DeferRefactorization, the factorization can be skipped
+    int Factor(bool allowDeferral = true);
+    // factorization with Eigen's SparseLU, in single precision, return values as Factor()
+    int FactorSinglePrecision(bool keepSymbolic);
+    // solves with the single-precision factorization, doesn't update the stats
+    void SolveSinglePrecision(void* pX, unsigned int nRHS, unsigned int ldim) const;
+    // solves one column in-place and refines it against the float64 matrix, using
+    // the given KLU workspace; the original right-hand side is left in work[0..n)
+    // returns the number of corrections, the final relative residual in residual
+    unsigned int SolveRefined(void* pXB, klu_numeric* pNumeric, klu_common* pCommon, std::vector<complex>& work, double& residual) const;
+    // refined solve of nRHS columns, refactors if a deferred factorization is not good enough
+    void SolveRefined(complex* acxVbus, unsigned int nRHS, unsigned int ldim);
+
+    // solves for a sparse right-hand side, returning only the requested (zero-based) entries
+    // of the solution; values in the format's element type
+    // return 1 for success, 0 for an invalid index
+    int SolveSparseRHS(unsigned int nnzB, const unsigned int* idxB, const void* valB, unsigned int nOut, const unsigned int* idxOut, void* valOut);
+    // copies the KLU factors to sparseFactors if outdated, returns false if not available
+    bool ExtractFactors();
+
+    // block factorization, return values as Factor()
+    int FactorBlocks(bool keepSymbolic);
+    // (re)factors a single block with the given KLU workspace, counting in blockStats
+    // return 1 for success, 0 for a KLU error
+    int FactorSingleBlock(FactorBlock& b, klu_common& common, KLUSolveXStats& blockStats);
+    // returns the pool for the parallel options, nullptr if single-threaded
+    WorkerPool* GetWorkerPool();
+    // partitions the current pattern in connected components, without factoring them
+    void BuildFactorBlocks();
+    void ClearFactorBlocks();
+    // solves with the block factorization; pNumerics: one per block, nullptr for the blocks' own
+    void SolveBlocks(void* pX, unsigned int nRHS, unsigned int ldim, klu_numeric* const* pNumerics, klu_common* pCommon, std::vector<double>& work) const;
+    // solves a single block, gathering its entries from pX and scattering the results back
+    void SolveBlock(size_t k, void* pX, unsigned int nRHS, unsigned int ldim, klu_numeric* numeric, klu_common* pCommon, std::vector<double>& work) const;
+    // solves the blocks concurrently, with the system's own factorization (Option_ParallelSolve)
+    void SolveBlocksParallel(void* pX, unsigned int nRHS, unsigned int ldim);
+
+    // runs klu_analyze on the current matrix, results in Symbolic and Common.status
+    void AnalyzeSymbolic();
+    // sets the blocks of givenOrdering in the single-block Symbolic from klu_analyze_given,
+    // returns false (Symbolic unchanged) if the pattern doesn't fit them
+    bool ApplyGivenBlocks(const int* Ap, const int* Ai);
+    // runs klu_factor on the current matrix and Symbolic, results in Numeric and Common.status
+    void FactorNumeric();
+    // runs klu_refactor on the current matrix, Symbolic and Numeric, returns true for success
+    bool RefactorNumeric();
+    // checks the result of klu_refactor against the thresholds
+    bool IsRefactorStable();
 
     // input: acxVbus[0] is ground voltage
     //        acxVbus[1..nBus] are current injections
     // output: acxVbus[1..nBus] are solved voltages
     void Solve(complex* acxVbus);
+    // same as above, for nRHS columns stored with leading dimension ldim
+    void Solve(complex* acxVbus, unsigned int nRHS, unsigned int ldim);
 
     // returns the number of connected components (cliques) in the whole system graph
     //  (i.e., considers Y11, Y12, and Y21 in addition to Y22)
@@ -140,10 +547,99 @@ public:
     // return in compressed triplet form, return 1 for success, 0 for a size mismatch
     int GetCompressedMatrix(unsigned int nColP, unsigned int nNZ, unsigned int* pColP, unsigned int* pRowIdx, complex* pMat);
     int GetTripletMatrix(unsigned int nNZ, unsigned int* pRows, unsigned int* pCols, complex* pMat);
+    // pointers to the compressed arrays of the current matrix, assembled first, without
+    // copies; valid while matrixVersion doesn't change. Return 1 for success
+    int GetMatrixView(KLUSolveXMatrixView* pView);
     
     int IncrementElement(unsigned int iRow, unsigned int iCol, double re, double im);
     int ZeroiseElement(unsigned int iRow, unsigned int iCol);
+
+    // resolves 1-based [pRows[k], pCols[k]] to CSC value indices (-1 if not present),
+    // valid for the pattern version returned in version
+    // return 1 if all elements were found, 0 otherwise
+    int GetElementSlots(unsigned int nElements, const unsigned int* pRows, const unsigned int* pCols, int32_t* pSlots, uint64_t& version);
+    // return 1 for success, 0 if any slot is invalid or the slots are from another
+    // pattern version (nothing is changed in that case)
+    int IncrementElements(unsigned int nElements, const int32_t* pSlots, const complex* pValues, uint64_t version);
+    int ZeroiseElements(unsigned int nElements, const int32_t* pSlots, uint64_t version);
+    // adds changes to 1-based existing entries, keeping the current factorization
+    // return 1 for success, 2 if the rank limit was exceeded (refactored on the next
+    // solve), 0 if an entry is not in the pattern or not supported in the current state
+    int AddLowRankUpdate(unsigned int nElements, const unsigned int* pRows, const unsigned int* pCols, const complex* pValues);
+    // drops the low-rank updates; revert: also subtract them from the matrix values
+    void ClearLowRankUpdates(bool revert);
+    void RefreshLowRankSlots();
+    // applies the low-rank correction to solutions of the factored system
+    void ApplyLowRankCorrection(void* pX, unsigned int nRHS, unsigned int ldim) const;
+    template <typename Scalar>
+    void UpdateLowRankCorrection(LowRankCorrection<Scalar>& lr, const std::vector<uint32_t>& touchedCols);
     int SaveAsMarketFiles(const char* fileNameMatrix, const double *b, const char* fileNameVector);
+
+    // ordering of the current Symbolic to/from a binary file, return 1 for success
+    int SaveSymbolic(const char* path);
+    int LoadSymbolic(const char* path);
+
+    // drops the primitive matrices kept with Option_KeepPrimitives
+    void ClearPrimitives(bool keepStorage);
+    // adds Yprim * V of the kept primitive matrices to I, return 1 for success, 0 if not kept
+    int AccumulatePrimitiveCurrents(const void* pV, void* pI);
+
+    // Y = A * X, or Y = B - A * X if pB is given; pNorm: if not null, the largest absolute
+    // value of Y. Vectors in the element type of the format, return 1 for success
+    int MultiplyMatrix(const void* pX, const void* pB, void* pY, double* pNorm);
+    template <typename MatrixT>
+    double MultiplyMatrix(MatrixT& A, const typename MatrixT::Scalar* x, const typename MatrixT::Scalar* b, typename MatrixT::Scalar* y);
+    // updates rowPattern for the current pattern
+    void BuildRowPattern(const int* Ap, const int* Ai);
+
+    // creates or disables the KLU memory pool, following Option_PooledKLUMemory
+    void UpdateKLUMemoryPool();
+
+    // sizes the assembly buffers and keeps them from now on (zero for both to release them)
+    void ReserveAssembly(uint32_t expectedNNZ, uint32_t expectedPrimitives);
+
+    // return 1 for success, 0 for an invalid method or permutation
+    int SetOrdering(unsigned int method, unsigned int n, const int32_t* pPerm);
+
+    // matrix, options and optional vectors to/from a binary file, return 1 for success
+    int SaveSnapshot(const char* path, const double* b, const double* x);
+    // for a new system, sets the options and the compressed matrix from the file
+    int LoadSnapshot(const char* path);
+    static int ReadSnapshotVectors(const char* path, unsigned int n, double* b, double* x);
+    // sets the ordering fields of Common from orderingMethod
+    void ApplyOrdering();
+};
+
+/* Private KLU workspace for solving against the factorization of a KLUSystemX
+from multiple threads. Each thread must use its own context. The factorization
+is shared read-only: the system must not be modified, refactored or deleted
+while any of its contexts are solving.
+*/
+class KLUSolveContextX
+{
+public:
+    KLUSolveContextX(KLUSystemX* pSys);
+
+    // input: current injections in acxB, output: node voltages in acxX
+    // returns 1 for success, 0 if the system is not factored,
+    // 2 if the refinement did not converge
+    int SolveSystem(complex* acxX, complex* acxB);
+
+protected:
+    KLUSystemX* pSys;
+    klu_common Common;
+    klu_numeric Numeric; // shallow copy of the system's Numeric, except for Xwork
+    std::vector<double> xwork;
+    std::vector<complex> refineWork;
+
+    // same as above for each block, with Option_BlockFactorization
+    std::vector<klu_numeric> blockNumerics;
+    std::vector<klu_numeric*> blockNumericPtrs;
+    std::vector<double> blockWork;
+    uint64_t factorVersion;
+
+    // refreshes the copy of the numeric factorization if required
+    bool Sync();
 };
 
 } // namespace KLUSolveX
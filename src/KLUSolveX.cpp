@@ -10,6 +10,7 @@
 #include "KLUSystemX.h"
 
 using KLUSolveX::KLUSystemX;
+using KLUSolveX::KLUSolveContextX;
 
 int KLUSOLVEX_STDCALL SetLogFile(char*, unsigned int) // Unused, kept for potential backwards compatibility
 {
@@ -22,14 +23,108 @@ void KLUSOLVEX_STDCALL SetOptions(void* handle, uint64_t opts)
     if (!pSys) 
         return;
     
-    int32_t previousFormat = pSys->dataFormat;
-    pSys->options = opts & ~0x00F0;
-    pSys->dataFormat = opts & 0x00F0;
+    pSys->SetOptions(opts);
+}
+
+int KLUSOLVEX_STDCALL SetRefactorThresholds(void* hSparse, double minRCond, double minRGrowth)
+{
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (!pSys)
+        return 0;
+
+    pSys->minRefactorRCond = minRCond;
+    pSys->minRefactorRGrowth = minRGrowth;
+    return 1;
+}
+
+int KLUSOLVEX_STDCALL GetRefactorCounts(void* hSparse, uint64_t* pAccepted, uint64_t* pRejected)
+{
+    int rc = 0;
+    *pAccepted = 0;
+    *pRejected = 0;
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (pSys)
+    {
+        *pAccepted = pSys->nRefactorAccepted;
+        *pRejected = pSys->nRefactorRejected;
+        rc = 1;
+    }
+    return rc;
+}
+
+int KLUSOLVEX_STDCALL SetRefinementParameters(void* hSparse, unsigned int maxIterations, double tolerance)
+{
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (!pSys)
+        return 0;
+
+    pSys->maxRefinementIterations = maxIterations;
+    pSys->refinementTolerance = tolerance;
+    return 1;
+}
 
-    if (previousFormat != pSys->dataFormat)
+int KLUSOLVEX_STDCALL GetRefinementInfo(void* hSparse, unsigned int* pIterations, double* pResidual)
+{
+    int rc = 0;
+    *pIterations = 0;
+    *pResidual = 0;
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (pSys)
     {
-        pSys->Initialize(pSys->m_nBus, 0, 0);
+        *pIterations = pSys->lastRefinementIterations;
+        *pResidual = pSys->lastRefinementResidual;
+        rc = 1;
     }
+    return rc;
+}
+
+int KLUSOLVEX_STDCALL AddLowRankUpdate(void* hSparse, unsigned int n, unsigned int* pRows, unsigned int* pCols, complex* pValues)
+{
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (!pSys)
+        return 0;
+
+    return pSys->AddLowRankUpdate(n, pRows, pCols, reinterpret_cast<KLUSolveX::complex*>(pValues));
+}
+
+int KLUSOLVEX_STDCALL ClearLowRankUpdates(void* hSparse)
+{
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (!pSys)
+        return 0;
+
+    pSys->ClearLowRankUpdates(true);
+    return 1;
+}
+
+int KLUSOLVEX_STDCALL SetLowRankLimit(void* hSparse, unsigned int maxRank)
+{
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (!pSys)
+        return 0;
+
+    pSys->maxLowRank = maxRank;
+    return 1;
+}
+
+int KLUSOLVEX_STDCALL SetThreadCount(void* hSparse, unsigned int nThreads)
+{
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (!pSys)
+        return 0;
+
+    pSys->nThreads = nThreads;
+    return 1;
+}
+
+int KLUSOLVEX_STDCALL ReserveSparseSet(void* hSparse, unsigned int expectedNNZ, unsigned int expectedPrimitives)
+{
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (!pSys)
+        return 0;
+
+    pSys->ReserveAssembly(expectedNNZ, expectedPrimitives);
+    return 1;
 }
 
 void* KLUSOLVEX_STDCALL NewSparseSet(unsigned int nBus)
@@ -113,6 +208,76 @@ int KLUSOLVEX_STDCALL SolveSparseSet(void* hSparse, complex* acxX, complex* acxB
     return rc;
 }
 
+int KLUSOLVEX_STDCALL SolveSparseSetInPlace(void* hSparse, complex* acxXB)
+{
+    int rc = 0;
+
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (pSys)
+    {
+        if (!pSys->bFactored || (pSys->reuseSymbolic && (pSys->options >= ReuseSymbolicFactorization)))
+        {
+            pSys->FactorSystem();
+        }
+        if (pSys->bFactored)
+        {
+            pSys->SolveSystemInPlace(reinterpret_cast<KLUSolveX::complex*>(acxXB));
+            rc = 1;
+        }
+        else
+        {
+            rc = 2;
+        }
+    }
+    return rc;
+}
+
+int KLUSOLVEX_STDCALL SolveSparseSetMulti(void* hSparse, unsigned int nRHS, complex* acxX, complex* acxB, unsigned int ldb)
+{
+    int rc = 0;
+
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (pSys && ldb >= pSys->GetSize())
+    {
+        if (!pSys->bFactored || (pSys->reuseSymbolic && (pSys->options >= ReuseSymbolicFactorization)))
+        {
+            pSys->FactorSystem();
+        }
+        if (pSys->bFactored)
+        {
+            rc = pSys->SolveSystemMulti(nRHS, reinterpret_cast<KLUSolveX::complex*>(acxX), reinterpret_cast<KLUSolveX::complex*>(acxB), ldb);
+        }
+        else
+        {
+            rc = 2;
+        }
+    }
+    return rc;
+}
+
+int KLUSOLVEX_STDCALL SolveSparseRHS(void* hSparse, unsigned int nnzB, unsigned int* idxB, complex* valB, unsigned int nOut, unsigned int* idxOut, complex* valOut)
+{
+    int rc = 0;
+
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (pSys)
+    {
+        if (!pSys->bFactored || (pSys->reuseSymbolic && (pSys->options >= ReuseSymbolicFactorization)))
+        {
+            pSys->FactorSystem();
+        }
+        if (pSys->bFactored)
+        {
+            rc = pSys->SolveSparseRHS(nnzB, idxB, valB, nOut, idxOut, valOut);
+        }
+        else
+        {
+            rc = 2;
+        }
+    }
+    return rc;
+}
+
 int KLUSOLVEX_STDCALL DeleteSparseSet(void* hSparse)
 {
     int rc = 0;
@@ -129,6 +294,56 @@ int KLUSOLVEX_STDCALL DeleteSparseSet(void* hSparse)
     return rc;
 }
 
+void* KLUSOLVEX_STDCALL NewSolveContext(void* hSparse)
+{
+    void* rc = 0;
+
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (pSys)
+    {
+        KLUSolveContextX* pCtx = new KLUSolveContextX(pSys);
+        rc = reinterpret_cast<void*>(pCtx);
+    }
+    return rc;
+}
+
+int KLUSOLVEX_STDCALL SolveSparseSetWithContext(void* hContext, complex* acxX, complex* acxB)
+{
+    int rc = 0;
+
+    KLUSolveContextX* pCtx = reinterpret_cast<KLUSolveContextX*>(hContext);
+    if (pCtx)
+    {
+        // the shared system is never factored here, that would not be thread-safe
+        switch (pCtx->SolveSystem(reinterpret_cast<KLUSolveX::complex*>(acxX), reinterpret_cast<KLUSolveX::complex*>(acxB)))
+        {
+            case 1:
+                rc = 1;
+                break;
+            case 2:
+                rc = 3; // refinement did not converge
+                break;
+            default:
+                rc = 2; // not factored
+                break;
+        }
+    }
+    return rc;
+}
+
+int KLUSOLVEX_STDCALL DeleteSolveContext(void* hContext)
+{
+    int rc = 0;
+
+    KLUSolveContextX* pCtx = reinterpret_cast<KLUSolveContextX*>(hContext);
+    if (pCtx)
+    {
+        delete pCtx;
+        rc = 1;
+    }
+    return rc;
+}
+
 /* i and j are 1-based for these */
 int KLUSOLVEX_STDCALL AddMatrixElement(void* hSparse, unsigned int i, unsigned int j, complex* pcxVal)
 {
@@ -218,6 +433,60 @@ int KLUSOLVEX_STDCALL ZeroiseMatrixElement(void* hSparse, unsigned int i, unsign
     return rc;
 }
 
+int KLUSOLVEX_STDCALL GetMatrixElementSlots(void* hSparse, unsigned int n, unsigned int* pRows, unsigned int* pCols, int32_t* pSlots, uint64_t* pVersion)
+{
+    int rc = 0;
+
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (pSys && pVersion)
+    {
+        rc = pSys->GetElementSlots(n, pRows, pCols, pSlots, *pVersion);
+    }
+    return rc;
+}
+
+int KLUSOLVEX_STDCALL IncrementMatrixElements(void* hSparse, unsigned int n, int32_t* pSlots, complex* pValues, uint64_t version)
+{
+    int rc = 0;
+
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (pSys)
+    {
+        rc = pSys->IncrementElements(n, pSlots, reinterpret_cast<KLUSolveX::complex*>(pValues), version);
+        if (rc)
+        {
+            pSys->bFactored = false;
+            pSys->reuseSymbolic = true;
+        }
+        else
+        {
+            pSys->reuseSymbolic = false;
+        }
+    }
+    return rc;
+}
+
+int KLUSOLVEX_STDCALL ZeroiseMatrixElements(void* hSparse, unsigned int n, int32_t* pSlots, uint64_t version)
+{
+    int rc = 0;
+
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (pSys)
+    {
+        rc = pSys->ZeroiseElements(n, pSlots, version);
+        if (rc)
+        {
+            pSys->bFactored = false;
+            pSys->reuseSymbolic = true;
+        }
+        else
+        {
+            pSys->reuseSymbolic = false;
+        }
+    }
+    return rc;
+}
+
 // new functions
 int KLUSOLVEX_STDCALL GetSize(void* hSparse, unsigned int* pResult)
 {
@@ -323,6 +592,30 @@ int KLUSOLVEX_STDCALL GetSingularCol(void* hSparse, unsigned int* pResult)
     return rc;
 }
 
+int KLUSOLVEX_STDCALL GetStats(void* hSparse, KLUSolveXStats* pStats)
+{
+    int rc = 0;
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (pSys && pStats)
+    {
+        pSys->GetStats(pStats);
+        rc = 1;
+    }
+    return rc;
+}
+
+int KLUSOLVEX_STDCALL ResetStats(void* hSparse)
+{
+    int rc = 0;
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (pSys)
+    {
+        pSys->ResetStats();
+        rc = 1;
+    }
+    return rc;
+}
+
 int KLUSOLVEX_STDCALL AddPrimitiveMatrix(void* hSparse, unsigned int nOrder, unsigned int* pNodes, complex* pcY)
 {
     int rc = 0;
@@ -336,6 +629,33 @@ int KLUSOLVEX_STDCALL AddPrimitiveMatrix(void* hSparse, unsigned int nOrder, uns
     return rc;
 }
 
+int KLUSOLVEX_STDCALL AccumulatePrimitiveCurrents(void* hSparse, complex* acxV, complex* acxI)
+{
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (!pSys || !acxV || !acxI)
+        return 0;
+
+    return pSys->AccumulatePrimitiveCurrents(acxV, acxI);
+}
+
+int KLUSOLVEX_STDCALL MultiplySparseSet(void* hSparse, complex* acxX, complex* acxY)
+{
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (!pSys || !acxX || !acxY || acxX == acxY)
+        return 0;
+
+    return pSys->MultiplyMatrix(acxX, nullptr, acxY, nullptr);
+}
+
+int KLUSOLVEX_STDCALL ResidualSparseSet(void* hSparse, complex* acxX, complex* acxB, complex* acxR, double* pNorm)
+{
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (!pSys || !acxX || !acxB || !acxR || acxX == acxR)
+        return 0;
+
+    return pSys->MultiplyMatrix(acxX, acxB, acxR, pNorm);
+}
+
 int KLUSOLVEX_STDCALL GetCompressedMatrix(void* hSparse, unsigned int nColP, unsigned int nNZ, unsigned int* pColP, unsigned int* pRowIdx, complex* pcY)
 {
     int rc = 0;
@@ -372,6 +692,28 @@ int KLUSOLVEX_STDCALL GetTripletMatrix(void* hSparse, unsigned int nNZ, unsigned
     return rc;
 }
 
+int KLUSOLVEX_STDCALL GetCompressedMatrixView(void* hSparse, KLUSolveXMatrixView* pView)
+{
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (!pSys || !pView)
+        return 0;
+
+    return pSys->GetMatrixView(pView);
+}
+
+int KLUSOLVEX_STDCALL GetMatrixVersion(void* hSparse, uint64_t* pVersion)
+{
+    int rc = 0;
+    *pVersion = 0;
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (pSys)
+    {
+        *pVersion = pSys->matrixVersion;
+        rc = 1;
+    }
+    return rc;
+}
+
 int KLUSOLVEX_STDCALL FindIslands(void* hSparse, unsigned int nOrder, unsigned int* pNodes)
 {
     int rc = 0;
@@ -393,3 +735,63 @@ int KLUSOLVEX_STDCALL SaveAsMarketFiles(void* hSparse, const char* fileNameMatri
     }
     return rc;
 }
+
+int KLUSOLVEX_STDCALL SaveSnapshot(void* hSparse, const char* path, const double* b, const double* x)
+{
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (!pSys)
+        return 0;
+
+    return pSys->SaveSnapshot(path, b, x);
+}
+
+void* KLUSOLVEX_STDCALL NewSparseSetFromSnapshot(const char* path)
+{
+    KLUSystemX* pSys = new KLUSystemX();
+    if (!pSys->LoadSnapshot(path))
+    {
+        delete pSys;
+        return 0;
+    }
+    return reinterpret_cast<void*>(pSys);
+}
+
+int KLUSOLVEX_STDCALL ReadSnapshotVectors(const char* path, unsigned int n, double* b, double* x)
+{
+    return KLUSystemX::ReadSnapshotVectors(path, n, b, x);
+}
+
+int KLUSOLVEX_STDCALL SaveSymbolic(void* hSparse, const char* path)
+{
+    int rc = 0;
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (pSys)
+    {
+        if (!pSys->bFactored)
+        {
+            pSys->FactorSystem();
+        }
+        rc = pSys->SaveSymbolic(path);
+    }
+    return rc;
+}
+
+int KLUSOLVEX_STDCALL LoadSymbolic(void* hSparse, const char* path)
+{
+    int rc = 0;
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (pSys)
+    {
+        rc = pSys->LoadSymbolic(path);
+    }
+    return rc;
+}
+
+int KLUSOLVEX_STDCALL SetOrdering(void* hSparse, unsigned int method, unsigned int n, int32_t* pPerm)
+{
+    KLUSystemX* pSys = reinterpret_cast<KLUSystemX*>(hSparse);
+    if (!pSys)
+        return 0;
+
+    return pSys->SetOrdering(method, n, pPerm);
+}
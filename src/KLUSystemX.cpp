@@ -8,12 +8,674 @@
 
 #include "KLUSystemX.h"
 #include <algorithm>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <numeric>
 #include <unsupported/Eigen/SparseExtra>
+#include <metis.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace KLUSolveX {
 
 using std::size_t;
 
+// Conversion between the complex values used in the API and each matrix format
+template <typename T> struct FormatValue;
+template <> struct FormatValue<complex>
+{
+    static complex From(const complex& v) { return v; }
+    static complex To(const complex& v) { return v; }
+};
+template <> struct FormatValue<double>
+{
+    static double From(const complex& v) { return v.real(); }
+    static complex To(double v) { return complex(v); }
+};
+template <> struct FormatValue<float>
+{
+    static float From(const complex& v) { return float(v.real()); }
+    static complex To(float v) { return complex(v); }
+};
+template <> struct FormatValue<std::complex<float> >
+{
+    static std::complex<float> From(const complex& v) { return std::complex<float>(v); }
+    static complex To(const std::complex<float>& v) { return complex(v); }
+};
+
+// sorts the rows of a column, with their values
+template <typename Scalar>
+static void SortColumn(int* Ai, Scalar* Ax, int nz)
+{
+    if (nz > 64)
+    {
+        std::vector<std::pair<int, Scalar> > entries(nz);
+        for (int k = 0; k < nz; ++k)
+            entries[k] = std::pair<int, Scalar>(Ai[k], Ax[k]);
+        std::sort(entries.begin(), entries.end(), [](const std::pair<int, Scalar>& a, const std::pair<int, Scalar>& b) { return a.first < b.first; });
+        for (int k = 0; k < nz; ++k)
+        {
+            Ai[k] = entries[k].first;
+            Ax[k] = entries[k].second;
+        }
+        return;
+    }
+    for (int k = 1; k < nz; ++k)
+    {
+        const int i = Ai[k];
+        const Scalar v = Ax[k];
+        int p = k;
+        for (; p > 0 && Ai[p - 1] > i; --p)
+        {
+            Ai[p] = Ai[p - 1];
+            Ax[p] = Ax[p - 1];
+        }
+        Ai[p] = i;
+        Ax[p] = v;
+    }
+}
+
+/*
+Same result as setFromTriplets (sorted columns, duplicates summed), but built
+in place in the storage of the matrix, which is first filled with all the
+triplets by column and then compacted. Nothing is allocated if the matrix
+already has the size and the storage for the triplets, and work the size for
+the columns. If keepStorage is false, the storage is trimmed to the non-zeros.
+Returns the number of bytes allocated.
+*/
+template <typename MatrixT>
+static size_t AssembleTriplets(MatrixT& mat, uint32_t n, const std::vector<Eigen::Triplet<complex> >& triplets, std::vector<int32_t>& work, bool keepStorage)
+{
+    typedef typename MatrixT::Scalar Scalar;
+    const size_t entryBytes = sizeof(Scalar) + sizeof(int);
+    size_t bytes = (uint32_t(mat.outerSize()) != n) ? (size_t(n) + 1) * sizeof(int) : 0;
+    const Eigen::Index capacity = mat.data().allocatedSize();
+
+    mat.resize(n, n);
+    mat.resizeNonZeros(triplets.size());
+    if (mat.data().allocatedSize() != capacity)
+        bytes += size_t(mat.data().allocatedSize()) * entryBytes;
+
+    int* Ap = mat.outerIndexPtr();
+    int* Ai = mat.innerIndexPtr();
+    Scalar* Ax = mat.valuePtr();
+
+    // place the entries by column
+    for (auto &t: triplets)
+        ++Ap[t.col() + 1];
+    for (uint32_t j = 0; j < n; ++j)
+        Ap[j + 1] += Ap[j];
+    work.assign(Ap, Ap + n);
+    for (auto &t: triplets)
+    {
+        const int p = work[t.col()]++;
+        Ai[p] = t.row();
+        Ax[p] = FormatValue<Scalar>::From(t.value());
+    }
+
+    // sum the duplicates, compacting the columns, then sort each one
+    work.assign(n, -1); // position of each row in the current column
+    int nz = 0;
+    for (uint32_t j = 0; j < n; ++j)
+    {
+        const int start = nz, end = Ap[j + 1];
+        for (int p = Ap[j]; p < end; ++p)
+        {
+            const int i = Ai[p];
+            if (work[i] >= start)
+            {
+                Ax[work[i]] += Ax[p];
+                continue;
+            }
+            work[i] = nz;
+            Ai[nz] = i;
+            Ax[nz] = Ax[p];
+            ++nz;
+        }
+        SortColumn(Ai + start, Ax + start, nz - start);
+        Ap[j] = start;
+    }
+    Ap[n] = nz;
+    mat.resizeNonZeros(nz);
+
+    if (!keepStorage && mat.data().allocatedSize() > nz)
+    {
+        mat.data().squeeze();
+        bytes += size_t(nz) * entryBytes;
+    }
+    return bytes;
+}
+
+// empties the matrix, releasing its storage unless keepStorage
+template <typename MatrixT>
+static void ReleaseMatrix(MatrixT& mat, bool keepStorage)
+{
+    if (keepStorage)
+        mat.setZero();
+    else
+        mat = MatrixT();
+}
+
+// sizes the matrix and reserves storage for nnz entries, if empty
+template <typename MatrixT>
+static void ReserveMatrix(MatrixT& mat, uint32_t n, size_t nnz)
+{
+    if (mat.nonZeros())
+        return;
+
+    mat.resize(n, n);
+    if (mat.data().allocatedSize() < Eigen::Index(nnz))
+        mat.reserve(nnz);
+}
+
+template <typename MatrixT>
+static void ScatterValues(MatrixT& mat, size_t nEntries, const int32_t* slots, const complex* pMat)
+{
+    typedef typename MatrixT::Scalar Scalar;
+    Scalar* Ax = mat.valuePtr();
+    for (size_t k = 0; k < nEntries; k++)
+    {
+        if (slots[k] >= 0)
+            Ax[slots[k]] += FormatValue<Scalar>::From(pMat[k]);
+    }
+}
+
+// moves the non-zero values to triplets, leaving an empty matrix
+template <typename MatrixT>
+static void MoveToTriplets(MatrixT& mat, std::vector<Eigen::Triplet<complex> >& triplets)
+{
+    typedef typename MatrixT::Scalar Scalar;
+    for (int k = 0; k < mat.outerSize(); ++k)
+    {
+        for (typename MatrixT::InnerIterator it(mat, k); it; ++it)
+        {
+            if (it.value() != Scalar(0))
+                triplets.push_back({ int(it.row()), int(it.col()), FormatValue<Scalar>::To(it.value()) });
+        }
+    }
+    mat.setZero();
+}
+
+// increments (or zeroes, if pValues is null) the values in the given slots
+template <typename MatrixT>
+static int UpdateSlots(MatrixT& mat, unsigned int nElements, const int32_t* pSlots, const complex* pValues)
+{
+    typedef typename MatrixT::Scalar Scalar;
+    if (!mat.isCompressed())
+        return 0; // the slots are indices in the compressed arrays
+
+    const uint32_t nnz = mat.nonZeros();
+    for (unsigned int k = 0; k < nElements; k++)
+    {
+        if (uint32_t(pSlots[k]) >= nnz)
+            return 0;
+    }
+    Scalar* Ax = mat.valuePtr();
+    if (pValues)
+    {
+        for (unsigned int k = 0; k < nElements; k++)
+            Ax[pSlots[k]] += FormatValue<Scalar>::From(pValues[k]);
+    }
+    else
+    {
+        for (unsigned int k = 0; k < nElements; k++)
+            Ax[pSlots[k]] = Scalar(0);
+    }
+    return 1;
+}
+
+template <typename MatrixT>
+static int CopyCompressed(MatrixT& mat, unsigned int nColP, unsigned int nNZ, unsigned int* pColP, unsigned int* pRowIdx, void* pMat)
+{
+    typedef typename MatrixT::Scalar Scalar;
+    if (!mat.isCompressed())
+        return 0; // the callers compress through CompressMatrix
+
+    if (nNZ < mat.nonZeros() || nColP <= mat.cols() || !mat.nonZeros())
+        return 0;
+
+    memcpy(pMat, mat.valuePtr(), mat.nonZeros() * sizeof(Scalar));
+    memcpy(pColP, mat.outerIndexPtr(), (mat.cols() + 1) * sizeof(int));
+    memcpy(pRowIdx, mat.innerIndexPtr(), mat.nonZeros() * sizeof(int));
+    return mat.nonZeros();
+}
+
+template <typename MatrixT>
+static bool ViewCompressed(MatrixT& mat, uint32_t n, KLUSolveXMatrixView* pView)
+{
+    if (mat.rows() != Eigen::Index(n) || mat.cols() != Eigen::Index(n) || !mat.isCompressed())
+        return false;
+
+    pView->nnz = mat.nonZeros();
+    pView->entrySize = sizeof(typename MatrixT::Scalar);
+    pView->pColP = mat.outerIndexPtr();
+    pView->pRowIdx = mat.innerIndexPtr();
+    pView->pValues = mat.valuePtr();
+    return true;
+}
+
+template <typename MatrixT>
+static int CopyTriplets(MatrixT& mat, unsigned int nNZ, unsigned int* pRows, unsigned int* pCols, complex* pMat)
+{
+    typedef typename MatrixT::Scalar Scalar;
+    if (!mat.isCompressed())
+        return 0; // the callers compress through CompressMatrix
+
+    if (nNZ < mat.nonZeros() || !mat.nonZeros())
+        return 0;
+
+    for (int k = 0; k < mat.outerSize(); ++k)
+    {
+        for (typename MatrixT::InnerIterator it(mat, k); it; ++it)
+        {
+            *(pMat++) = FormatValue<Scalar>::To(it.value());
+            *(pRows++) = it.row();
+            *(pCols++) = it.col();
+        }
+    }
+    return mat.nonZeros();
+}
+
+// factorization with Eigen's SparseLU, returns true for success
+template <typename SolverT, typename MatrixT>
+static bool FactorSparseLU(std::unique_ptr<SolverT>& lu, const MatrixT& mat, bool keepPattern, KLUSolveXStats& stats)
+{
+    if (!keepPattern || !lu)
+    {
+        ++stats.symbolicReuseMisses;
+        lu.reset(new SolverT());
+        PhaseTimer timer(stats.analyze);
+        lu->analyzePattern(mat);
+    }
+    else
+    {
+        ++stats.symbolicReuseHits;
+    }
+    {
+        // SparseLU always chooses new pivots, the numeric factorization is never reused
+        PhaseTimer timer(stats.factor);
+        lu->factorize(mat);
+    }
+    return lu->info() == Eigen::Success;
+}
+
+template <typename SolverT>
+static void SolveSparseLU(const SolverT& lu, void* pX, uint32_t n, unsigned int nRHS, unsigned int ldim)
+{
+    typedef typename SolverT::Scalar Scalar;
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> DenseMatrix;
+    Eigen::Map<DenseMatrix, 0, Eigen::OuterStride<> > X(reinterpret_cast<Scalar*>(pX), n, nRHS, Eigen::OuterStride<>(ldim));
+    const DenseMatrix solution = lu.solve(X);
+    X = solution;
+}
+
+static void KLUSolveBlock(klu_symbolic* Symbolic, klu_numeric* Numeric, int ldim, int nRHS, double* B, klu_common* Common)
+{
+    klu_solve(Symbolic, Numeric, ldim, nRHS, B, Common);
+}
+
+static void KLUSolveBlock(klu_symbolic* Symbolic, klu_numeric* Numeric, int ldim, int nRHS, complex* B, klu_common* Common)
+{
+    klu_z_solve(Symbolic, Numeric, ldim, nRHS, reinterpret_cast<double*>(B), Common);
+}
+
+// Solves a single float64 column with KLU
+struct KLUColumnSolver
+{
+    klu_symbolic* Symbolic;
+    klu_numeric* Numeric;
+    klu_common* Common;
+    int n;
+
+    template <typename Scalar>
+    void operator()(Scalar* v) const
+    {
+        KLUSolveBlock(Symbolic, Numeric, n, 1, v, Common);
+    }
+};
+
+// Solves a single float64 column with a single-precision factorization
+template <typename SolverT>
+struct LoweredColumnSolver
+{
+    const SolverT& lu;
+
+    template <typename Scalar>
+    void operator()(Scalar* v) const
+    {
+        typedef typename SolverT::Scalar LowScalar;
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        typedef Eigen::Matrix<LowScalar, Eigen::Dynamic, 1> LowVector;
+        Eigen::Map<Vector> V(v, lu.rows());
+        const LowVector low = V.template cast<LowScalar>();
+        const LowVector solution = lu.solve(low);
+        V = solution.template cast<Scalar>();
+    }
+};
+
+/*
+Solves A*x = b in-place in x, with an approximate factorization of A, then
+applies corrections until the normwise backward error
+    max|b - A*x| / (|A| * max|x| + max|b|)
+is below tolerance, with |A| the largest column sum of absolute values.
+The right-hand side is kept in b, r is used for the residual. Returns the
+number of corrections, the final backward error in residual.
+*/
+template <typename MatrixT, typename SolveFn>
+static unsigned int RefineSolution(const MatrixT& A, typename MatrixT::Scalar* x, typename MatrixT::Scalar* b, typename MatrixT::Scalar* r,
+    const SolveFn& solve, unsigned int maxIterations, double tolerance, double& residual)
+{
+    typedef typename MatrixT::Scalar Scalar;
+    const Eigen::Index n = A.rows();
+
+    std::copy(x, x + n, b);
+    double bNorm = 0;
+    for (Eigen::Index i = 0; i < n; ++i)
+        bNorm = std::max(bNorm, double(std::abs(b[i])));
+
+    solve(x);
+    unsigned int nSteps = 0;
+    for (;;)
+    {
+        double aNorm = 0, xNorm = 0, rNorm = 0;
+        std::copy(b, b + n, r);
+        for (Eigen::Index j = 0; j < A.outerSize(); ++j)
+        {
+            const Scalar xj = x[j];
+            double colSum = 0;
+            for (typename MatrixT::InnerIterator it(A, j); it; ++it)
+            {
+                r[it.row()] -= it.value() * xj;
+                colSum += std::abs(it.value());
+            }
+            aNorm = std::max(aNorm, colSum);
+            xNorm = std::max(xNorm, double(std::abs(xj)));
+        }
+        for (Eigen::Index i = 0; i < n; ++i)
+            rNorm = std::max(rNorm, double(std::abs(r[i])));
+
+        const double scale = aNorm * xNorm + bNorm;
+        residual = (scale > 0) ? (rNorm / scale) : rNorm;
+        if (residual <= tolerance || nSteps >= maxIterations)
+            return nSteps;
+
+        solve(r);
+        for (Eigen::Index i = 0; i < n; ++i)
+            x[i] += r[i];
+        ++nSteps;
+    }
+}
+
+// KLU memory pool of the system whose KLU calls are running on this thread
+static thread_local KLUMemoryPool* currentKLUPool = nullptr;
+
+// SuiteSparse memory functions replaced by the pool ones
+static void* (*previousMalloc)(size_t) = nullptr;
+static void* (*previousCalloc)(size_t, size_t) = nullptr;
+static void* (*previousRealloc)(void*, size_t) = nullptr;
+static void (*previousFree)(void*) = nullptr;
+
+static void* PoolMalloc(size_t size)
+{
+    KLUMemoryPool* pool = currentKLUPool;
+    return pool ? pool->Allocate(size) : previousMalloc(size);
+}
+
+static void* PoolCalloc(size_t count, size_t size)
+{
+    KLUMemoryPool* pool = currentKLUPool;
+    if (!pool)
+        return previousCalloc(count, size);
+    if (size && count > std::numeric_limits<size_t>::max() / size)
+        return nullptr;
+
+    void* p = pool->Allocate(count * size);
+    if (p)
+        memset(p, 0, count * size);
+    return p;
+}
+
+static void* PoolRealloc(void* p, size_t size)
+{
+    KLUMemoryPool* pool = currentKLUPool;
+    if (!pool)
+        return previousRealloc(p, size);
+    if (!p)
+        return pool->Allocate(size);
+
+    const size_t blockSize = pool->GetBlockSize(p);
+    if (!blockSize)
+        return previousRealloc(p, size); // allocated before the pool
+    if (size <= blockSize)
+        return p;
+
+    void* q = pool->Allocate(size);
+    if (!q)
+        return nullptr;
+    memcpy(q, p, blockSize);
+    pool->Release(p);
+    return q;
+}
+
+static void PoolFree(void* p)
+{
+    KLUMemoryPool* pool = currentKLUPool;
+    if (p && pool && pool->Release(p))
+        return;
+    previousFree(p);
+}
+
+// replaces the SuiteSparse memory functions, once for the process
+static void InstallPoolFunctions()
+{
+    static std::once_flag installed;
+    std::call_once(installed, []() {
+#if SUITESPARSE_MAIN_VERSION >= 7
+        previousMalloc = SuiteSparse_config_malloc_func_get();
+        previousCalloc = SuiteSparse_config_calloc_func_get();
+        previousRealloc = SuiteSparse_config_realloc_func_get();
+        previousFree = SuiteSparse_config_free_func_get();
+#else
+        previousMalloc = SuiteSparse_config.malloc_func;
+        previousCalloc = SuiteSparse_config.calloc_func;
+        previousRealloc = SuiteSparse_config.realloc_func;
+        previousFree = SuiteSparse_config.free_func;
+#endif
+        if (!previousMalloc)
+            previousMalloc = malloc;
+        if (!previousCalloc)
+            previousCalloc = calloc;
+        if (!previousRealloc)
+            previousRealloc = realloc;
+        if (!previousFree)
+            previousFree = free;
+
+#if SUITESPARSE_MAIN_VERSION >= 7
+        SuiteSparse_config_malloc_func_set(PoolMalloc);
+        SuiteSparse_config_calloc_func_set(PoolCalloc);
+        SuiteSparse_config_realloc_func_set(PoolRealloc);
+        SuiteSparse_config_free_func_set(PoolFree);
+#else
+        SuiteSparse_config.malloc_func = PoolMalloc;
+        SuiteSparse_config.calloc_func = PoolCalloc;
+        SuiteSparse_config.realloc_func = PoolRealloc;
+        SuiteSparse_config.free_func = PoolFree;
+#endif
+    });
+}
+
+// size class of an allocation: multiples of 64 bytes up to 512, then 8 classes
+// per power of two, wasting at most 12.5%
+static size_t PoolSizeClass(size_t size)
+{
+    if (size <= 512)
+        return (size + 63) & ~size_t(63);
+
+    int log2 = 0;
+    for (size_t v = size - 1; v > 1; v >>= 1)
+        ++log2;
+    const size_t step = size_t(1) << (log2 - 3);
+    return (size + step - 1) & ~(step - 1);
+}
+
+KLUMemoryPool::KLUMemoryPool()
+    : usedBytes(0)
+    , cachedBytes(0)
+    , peakBytes(0)
+    , hits(0)
+    , misses(0)
+    , pooling(true)
+{
+    InstallPoolFunctions();
+}
+
+KLUMemoryPool::~KLUMemoryPool()
+{
+    // blocks still in use are left to the previous functions
+    TrimLocked();
+}
+
+void* KLUMemoryPool::Allocate(size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!pooling)
+        return previousMalloc(size);
+
+    const size_t sizeClass = PoolSizeClass(size);
+    void* p = nullptr;
+    auto it = cached.find(sizeClass);
+    if (it != cached.end() && !it->second.empty())
+    {
+        p = it->second.back();
+        it->second.pop_back();
+        cachedBytes -= sizeClass;
+        ++hits;
+    }
+    else
+    {
+        // the cached sizes are not being asked for, don't grow the pool to keep them
+        if (cachedBytes && usedBytes + cachedBytes + sizeClass > peakBytes)
+            TrimLocked();
+
+        p = previousMalloc(sizeClass);
+        if (!p)
+            return nullptr;
+        ++misses;
+    }
+    try
+    {
+        blocks[p] = sizeClass;
+    }
+    catch (const std::bad_alloc&)
+    {
+        previousFree(p);
+        return nullptr;
+    }
+    usedBytes += sizeClass;
+    peakBytes = std::max(peakBytes, usedBytes + cachedBytes);
+    return p;
+}
+
+bool KLUMemoryPool::Release(void* p)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = blocks.find(p);
+    if (it == blocks.end())
+        return false;
+
+    const size_t sizeClass = it->second;
+    blocks.erase(it);
+    usedBytes -= sizeClass;
+    if (pooling)
+    {
+        try
+        {
+            cached[sizeClass].push_back(p);
+            cachedBytes += sizeClass;
+            return true;
+        }
+        catch (const std::bad_alloc&)
+        {
+        }
+    }
+    previousFree(p);
+    return true;
+}
+
+size_t KLUMemoryPool::GetBlockSize(void* p)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = blocks.find(p);
+    return (it == blocks.end()) ? 0 : it->second;
+}
+
+void KLUMemoryPool::Trim()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    TrimLocked();
+}
+
+void KLUMemoryPool::TrimLocked()
+{
+    for (auto &sizeBlocks: cached)
+    {
+        for (void* p: sizeBlocks.second)
+            previousFree(p);
+    }
+    cached.clear();
+    cachedBytes = 0;
+}
+
+void KLUMemoryPool::SetPooling(bool enable)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    pooling = enable;
+    if (!enable)
+        TrimLocked();
+}
+
+void KLUMemoryPool::GetStats(KLUSolveXStats& stats)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.kluPoolBytes = usedBytes + cachedBytes;
+    stats.kluPoolPeak = peakBytes;
+    stats.kluPoolHits = hits;
+    stats.kluPoolMisses = misses;
+}
+
+void KLUMemoryPool::ResetCounters()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    hits = misses = 0;
+}
+
+// selects the KLU memory pool of a system (or none) for the KLU calls in this scope
+class KLUMemoryScope
+{
+public:
+    explicit KLUMemoryScope(KLUMemoryPool* pool)
+        : previous(currentKLUPool)
+    {
+        currentKLUPool = pool;
+    }
+    ~KLUMemoryScope()
+    {
+        currentKLUPool = previous;
+    }
+
+private:
+    KLUMemoryPool* previous;
+};
+
 KLUSystemX::KLUSystemX()
 {
     InitDefaults();
@@ -46,19 +708,73 @@ void KLUSystemX::NullPointers()
 void KLUSystemX::InitDefaults()
 {
     options = 0;
+    flags = 0;
     dataFormat = 0;
 
     m_nBus = 0;
     bFactored = false;
     reuseSymbolic = false;
+    factorVersion = 0;
+    minRefactorRCond = 0;
+    minRefactorRGrowth = 0;
+    nRefactorAccepted = nRefactorRejected = 0;
+    maxRefinementIterations = 10;
+    refinementTolerance = 1e-14;
+    lastRefinementIterations = 0;
+    lastRefinementResidual = 0;
+    staleFactorization = false;
+    maxLowRank = 32;
+    lrPatternVersion = 0;
+    nThreads = 0;
+    reserveNNZ = reservePrimitives = 0;
+    orderingMethod = Ordering_AMD;
+    sparseFactors.valid = false;
+    sparseWork.stamp = 0;
+    ResetStats();
+    asmState = AsmMap_None;
+    asmNodesPos = asmSlotsPos = 0;
+    samePattern = false;
+    patternVersion = 0;
+    primColored = false;
+    factorPatternVersion = 0;
+    matrixVersion = 0;
+    factorMatrixVersion = 0;
+    rowPattern.patternVersion = 0;
     ZeroIndices();
     NullPointers();
 }
 
 void KLUSystemX::Clear()
 {
-    spmat = SparseMatrix();
-    triplets = std::vector<Eigen::Triplet<complex>>();
+    KLUMemoryScope memoryScope(kluPool.get());
+    // with ReserveSparseSet, the storage of the current format is kept for the next assembly
+    const bool keepBuffers = KeepsAssemblyBuffers();
+    ReleaseMatrix(spmat, keepBuffers && (dataFormat == 0));
+    ReleaseMatrix(spmat_f64, keepBuffers && (dataFormat == MatrixFormat_DoublePrecisionReal));
+    ReleaseMatrix(spmat_f32, keepBuffers && (dataFormat == MatrixFormat_SinglePrecisionReal));
+    ReleaseMatrix(spmat_c64, keepBuffers && (dataFormat == MatrixFormat_SinglePrecisionComplex));
+    lu_f32.reset();
+    lu_c64.reset();
+    staleFactorization = false;
+    refineWork = std::vector<complex>();
+    ClearLowRankUpdates(false);
+    ClearFactorBlocks();
+    sparseFactors = ExtractedFactors();
+    sparseWork = SparseSolveWork();
+    if (keepBuffers)
+    {
+        triplets.clear();
+    }
+    else
+    {
+        triplets = std::vector<Eigen::Triplet<complex>>();
+        assemblyWork = std::vector<int32_t>();
+    }
+    ClearAssemblyMap();
+    ++patternVersion;
+    ClearPrimitives(keepBuffers);
+    rowPattern = RowPattern();
+    ++matrixVersion;
 
     if (Numeric)
         klu_free_numeric(&Numeric, &Common);
@@ -75,65 +791,269 @@ int KLUSystemX::Initialize(unsigned int nBus, unsigned int nV, unsigned int nI)
 
     klu_defaults(&Common);
     Common.halt_if_singular = 0;
+    ApplyOrdering();
 
     m_nBus = m_nX = nBus;
 
+    const size_t nnzReserve = GetAssemblyReserve();
     switch (dataFormat)
     {
         case MatrixFormat_DoublePrecisionReal:
-            spmat_f64 = SparseMatrixF64(m_nX, m_nX);
-            spmat_f64.reserve(4 * size_t(m_nX));
+            ReserveMatrix(spmat_f64, m_nX, nnzReserve);
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+            ReserveMatrix(spmat_c64, m_nX, nnzReserve);
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            ReserveMatrix(spmat_f32, m_nX, nnzReserve);
             break;
         default:
-            spmat = SparseMatrix(m_nX, m_nX);
-            spmat.reserve(4 * size_t(m_nX));
+            ReserveMatrix(spmat, m_nX, nnzReserve);
             break;
     }    
+    if (KeepsAssemblyBuffers())
+        triplets.reserve(nnzReserve);
+
     return 0;
 }
 
-int KLUSystemX::FactorSystem()
+void KLUSystemX::SetOptions(uint64_t opts)
 {
-    bFactored = false;
+    int32_t previousFormat = dataFormat;
+    const uint64_t previousFlags = flags;
+    options = opts & 0x000F;
+    flags = opts & ~uint64_t(0x00FF);
+    dataFormat = opts & 0x00F0;
 
-    int rc = Factor();
+    if ((previousFlags ^ flags) & Option_PooledKLUMemory)
+    {
+        UpdateKLUMemoryPool();
+    }
+    if ((previousFlags & Option_KeepPrimitives) && !(flags & Option_KeepPrimitives))
+    {
+        ClearPrimitives(false);
+    }
 
-    if (rc == 1)
+    if (previousFormat != dataFormat)
     {
-        bFactored = true;
-        reuseSymbolic = false;
-        return 0;
+        Initialize(m_nBus, 0, 0);
+    }
+    else if ((previousFlags ^ flags) & (Option_MixedPrecisionFactor | Option_DeferRefactorization | Option_BlockFactorization))
+    {
+        // the current factorization was done by the other solver or may be stale
+        bFactored = false;
+        staleFactorization = false;
+        ClearFactorBlocks();
+        // force the next factorization, even if the matrix didn't change
+        if (triplets.empty())
+            samePattern = true;
     }
-    return 1;
 }
 
-void KLUSystemX::SolveSystem(complex* acxX, complex* acxB)
+size_t KLUSystemX::GetAssemblyReserve() const
+{
+    // without a hint, a guess that grows as needed
+    if (!KeepsAssemblyBuffers())
+        return 4 * size_t(m_nX);
+
+    // 3-phase series elements have 36 entries, and the others fewer
+    return std::max(size_t(reserveNNZ), 36 * size_t(reservePrimitives));
+}
+
+void KLUSystemX::ReserveAssembly(uint32_t expectedNNZ, uint32_t expectedPrimitives)
 {
+    reserveNNZ = expectedNNZ;
+    reservePrimitives = expectedPrimitives;
+    if (!KeepsAssemblyBuffers())
+        return; // released after the next use
+
+    const size_t nnzReserve = GetAssemblyReserve();
+    triplets.reserve(nnzReserve);
+    assemblyWork.reserve(m_nX);
+    asmNodes.reserve(7 * size_t(reservePrimitives));
+    ++matrixVersion; // an empty matrix may be reallocated
     switch (dataFormat)
     {
         case MatrixFormat_DoublePrecisionReal:
-            memcpy(&acxX[0], acxB, sizeof(double) * m_nBus);
-            Solve(&acxX[0]);
-            return;
+            ReserveMatrix(spmat_f64, m_nX, nnzReserve);
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+            ReserveMatrix(spmat_c64, m_nX, nnzReserve);
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            ReserveMatrix(spmat_f32, m_nX, nnzReserve);
+            break;
         default:
-            memcpy(&acxX[0], acxB, sizeof(complex) * m_nBus);
-            Solve(&acxX[0]);
-            return;
+            ReserveMatrix(spmat, m_nX, nnzReserve);
+            break;
     }
 }
 
-int KLUSystemX::AddPrimitiveMatrix(unsigned int nOrder, unsigned int* pNodes, complex* pMat)
+size_t KLUSystemX::GetEntrySize() const
 {
-    int i, j, idRow, idCol, idVal;
-    double re, im;
-
-    // check the node numbers
-    for (i = 0; i < nOrder; i++)
+    switch (dataFormat)
     {
-        if (pNodes[i] > m_nBus)
+        case MatrixFormat_DoublePrecisionReal:
+            return sizeof(double);
+        case MatrixFormat_SinglePrecisionComplex:
+            return sizeof(std::complex<float>);
+        case MatrixFormat_SinglePrecisionReal:
+            return sizeof(float);
+        default:
+            return sizeof(complex);
+    }
+}
+
+bool KLUSystemX::HasFactorization() const
+{
+    if (UsesBlockFactorization())
+    {
+        for (auto &b: factorBlocks)
+        {
+            if (!b.Numeric)
+                return false;
+        }
+        return !factorBlocks.empty();
+    }
+    if (!UsesSparseLU())
+        return Symbolic && Numeric;
+
+    switch (dataFormat)
+    {
+        case MatrixFormat_SinglePrecisionReal:
+        case MatrixFormat_DoublePrecisionReal:
+            return lu_f32 && lu_f32->info() == Eigen::Success;
+        default:
+            return lu_c64 && lu_c64->info() == Eigen::Success;
+    }
+}
+
+bool KLUSystemX::GetPattern(const int*& Ap, const int*& Ai)
+{
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            if (!spmat_f64.isCompressed())
+                return false;
+            Ap = spmat_f64.outerIndexPtr();
+            Ai = spmat_f64.innerIndexPtr();
+            return true;
+        case MatrixFormat_SinglePrecisionComplex:
+            if (!spmat_c64.isCompressed())
+                return false;
+            Ap = spmat_c64.outerIndexPtr();
+            Ai = spmat_c64.innerIndexPtr();
+            return true;
+        case MatrixFormat_SinglePrecisionReal:
+            if (!spmat_f32.isCompressed())
+                return false;
+            Ap = spmat_f32.outerIndexPtr();
+            Ai = spmat_f32.innerIndexPtr();
+            return true;
+        default:
+            if (!spmat.isCompressed())
+                return false;
+            Ap = spmat.outerIndexPtr();
+            Ai = spmat.innerIndexPtr();
+            return true;
+    }
+}
+
+uint64_t KLUSystemX::GetPatternHash()
+{
+    const int* Ap;
+    const int* Ai;
+    if (!GetPattern(Ap, Ai))
+        return 0;
+
+    // FNV-1a, a word at a time
+    uint64_t hash = 14695981039346656037ULL;
+    auto mix = [&hash](uint32_t v) { hash = (hash ^ v) * 1099511628211ULL; };
+    mix(m_nX);
+    for (uint32_t j = 0; j <= m_nX; ++j)
+        mix(Ap[j]);
+    for (int p = 0; p < Ap[m_nX]; ++p)
+        mix(Ai[p]);
+    return hash;
+}
+
+int KLUSystemX::FactorSystem()
+{
+    bFactored = false;
+
+    int rc = Factor();
+
+    if (rc == 1)
+    {
+        bFactored = true;
+        reuseSymbolic = false;
+        return 0;
+    }
+    return 1;
+}
+
+void KLUSystemX::SolveSystem(complex* acxX, complex* acxB)
+{
+    if (acxX == acxB)
+    {
+        // caller passed the same buffer, KLU already solves in-place
+        Solve(acxX);
+        return;
+    }
+    memcpy(&acxX[0], acxB, GetEntrySize() * m_nBus);
+    Solve(&acxX[0]);
+}
+
+void KLUSystemX::SolveSystemInPlace(complex* acxXB)
+{
+    Solve(acxXB);
+}
+
+int KLUSystemX::SolveSystemMulti(unsigned int nRHS, complex* acxX, complex* acxB, unsigned int ldim)
+{
+    if (ldim < m_nBus)
+        return 0;
+    if (nRHS == 0 || m_nBus == 0)
+        return 1;
+
+    // KLU solves in-place; the right-hand sides are copied once as a
+    // whole block, and KLU then traverses L and U once per group of
+    // columns instead of once per column
+    const size_t elemSize = GetEntrySize();
+    if (acxX != acxB)
+        memcpy(acxX, acxB, elemSize * size_t(ldim) * (nRHS - 1) + elemSize * m_nBus);
+
+    Solve(acxX, nRHS, ldim);
+    return 1;
+}
+
+int KLUSystemX::AddPrimitiveMatrix(unsigned int nOrder, unsigned int* pNodes, complex* pMat)
+{
+    int i, j, idRow, idCol, idVal;
+    double re, im;
+
+    // check the node numbers
+    for (i = 0; i < nOrder; i++)
+    {
+        if (pNodes[i] > m_nBus)
             return 0;
     }
 
+    if (flags & Option_KeepPrimitives)
+        KeepPrimitive(nOrder, pNodes, pMat);
+
+    ++matrixVersion;
+
+    if (asmState == AsmMap_Replaying)
+    {
+        if (ReplayPrimitiveMatrix(nOrder, pNodes, pMat))
+            return 1;
+
+        AbandonAssemblyMap();
+    }
+    if (flags & Option_ReuseAssemblyMap)
+        RecordPrimitiveMatrix(nOrder, pNodes);
+
     // add the matrix
     for (i = 0; i < nOrder; i++)
     {
@@ -164,638 +1084,3296 @@ int KLUSystemX::AddPrimitiveMatrix(unsigned int nOrder, unsigned int* pNodes, co
     return 1;
 }
 
-void KLUSystemX::ProcessTriplets()
+void KLUSystemX::ClearAssemblyMap()
 {
-    switch (dataFormat)
+    asmNodes.clear();
+    asmSlots.clear();
+    asmNodesPos = asmSlotsPos = 0;
+    asmState = AsmMap_None;
+    samePattern = false;
+}
+
+void KLUSystemX::RecordPrimitiveMatrix(unsigned int nOrder, unsigned int* pNodes)
+{
+    switch (asmState)
     {
-        case MatrixFormat_DoublePrecisionReal:
-        {
-            std::vector<Eigen::Triplet<double> > triplets_f64;
-            triplets_f64.reserve(triplets.size());
-            for (auto &t: triplets)
-            {
-                triplets_f64.push_back({t.row(), t.col(), t.value().real()});
-            }
-            spmat_f64.setFromTriplets(triplets_f64.begin(), triplets_f64.end());
-            m_NZpre = spmat_f64.nonZeros();
+        case AsmMap_None:
+            // only start recording on a clean matrix, otherwise the
+            // previous entries would not be reproduced by a replay
+            if (triplets.size() || spmat.nonZeros() || spmat_f64.nonZeros() || spmat_f32.nonZeros() || spmat_c64.nonZeros())
+                return;
+            break;
+        case AsmMap_Ready:
+            // the new triplets will replace the current CSC matrix in ProcessTriplets
+            asmNodes.clear();
+            asmSlots.clear();
             break;
-        }
         default:
-            spmat.setFromTriplets(triplets.begin(), triplets.end());
-            m_NZpre = spmat.nonZeros();
             break;
     }
-    triplets = std::vector<Eigen::Triplet<complex>>();
+    asmState = AsmMap_Recording;
+    asmNodes.push_back(nOrder);
+    asmNodes.insert(asmNodes.end(), pNodes, pNodes + nOrder);
 }
 
-int KLUSystemX::Factor()
+void KLUSystemX::BuildAssemblySlots()
 {
-    int32_t nrows;
-    // first convert the triplets to column-compressed form, and prep the columns
-    if (triplets.size())
+    size_t numSlots = 0;
+    for (size_t pos = 0; pos < asmNodes.size(); pos += 1 + asmNodes[pos])
+        numSlots += size_t(asmNodes[pos]) * asmNodes[pos];
+
+    asmSlots.resize(numSlots);
+    int32_t* slot = asmSlots.data();
+    for (size_t pos = 0; pos < asmNodes.size(); pos += 1 + asmNodes[pos])
     {
-        ProcessTriplets();
-        switch (dataFormat)
+        const uint32_t nOrder = asmNodes[pos];
+        const uint32_t* pNodes = &asmNodes[pos + 1];
+        // same column-major layout as the primitive matrix
+        for (uint32_t j = 0; j < nOrder; j++)
         {
-            case MatrixFormat_DoublePrecisionReal:
-                spmat_f64.makeCompressed(); // should be a no-op here
-                nrows = spmat_f64.rows();
-                break;
-            default:
-                spmat.makeCompressed(); // should be a no-op here
-                nrows = spmat.rows();
-                break;
+            for (uint32_t i = 0; i < nOrder; i++)
+            {
+                *(slot++) = (pNodes[i] && pNodes[j]) ? FindValueIndex(pNodes[i] - 1, pNodes[j] - 1) : -1;
+            }
         }
     }
-    else if ((options != ReuseCompressedMatrix) && !(reuseSymbolic && (options >= ReuseSymbolicFactorization)))
+    asmState = AsmMap_Ready;
+}
+
+bool KLUSystemX::ReplayPrimitiveMatrix(unsigned int nOrder, unsigned int* pNodes, complex* pMat)
+{
+    if (asmNodesPos >= asmNodes.size() || asmNodes[asmNodesPos] != nOrder)
+        return false;
+    if (memcmp(&asmNodes[asmNodesPos + 1], pNodes, sizeof(uint32_t) * nOrder) != 0)
+        return false;
+
+    const size_t nEntries = size_t(nOrder) * nOrder;
+    const int32_t* slots = &asmSlots[asmSlotsPos];
+
+    // check everything first, so that a fallback starts from a consistent state
+    for (size_t k = 0; k < nEntries; k++)
     {
-        // otherwise, compression and factoring has already been done
-        if (m_fltBus)
-            return -1; // was found singular before
-        return 1; // was found okay before
+        if (slots[k] < 0 && (pMat[k].real() != 0.0 || pMat[k].imag() != 0.0) && pNodes[k % nOrder] && pNodes[k / nOrder])
+            return false; // new entry in the pattern
     }
 
-    // then factor Y22
-    if (!(reuseSymbolic && (options >= ReuseSymbolicFactorization)))
+    switch (dataFormat)
     {
-        if (Symbolic)
-            klu_free_symbolic(&Symbolic, &Common);
-        Symbolic = nullptr;
+        case MatrixFormat_DoublePrecisionReal:
+            ScatterValues(spmat_f64, nEntries, slots, pMat);
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+            ScatterValues(spmat_c64, nEntries, slots, pMat);
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            ScatterValues(spmat_f32, nEntries, slots, pMat);
+            break;
+        default:
+            ScatterValues(spmat, nEntries, slots, pMat);
+            break;
     }
-    if (!(reuseSymbolic && (options >= ReuseSymbolicFactorization)) || !(Numeric && (options >= ReuseNumericFactorization)))
+
+    asmNodesPos += 1 + nOrder;
+    asmSlotsPos += nEntries;
+    return true;
+}
+
+void KLUSystemX::AbandonAssemblyMap()
+{
+    ++stats.assemblyMapMisses;
+
+    // move the values replayed so far to triplets, and continue
+    // recording from there
+    switch (dataFormat)
     {
-        if (Numeric)
-        {
-            klu_free_numeric(&Numeric, &Common); // Works for everything
-        }
-        Numeric = nullptr;
+        case MatrixFormat_DoublePrecisionReal:
+            MoveToTriplets(spmat_f64, triplets);
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+            MoveToTriplets(spmat_c64, triplets);
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            MoveToTriplets(spmat_f32, triplets);
+            break;
+        default:
+            MoveToTriplets(spmat, triplets);
+            break;
     }
+    asmNodes.resize(asmNodesPos);
+    asmSlots.clear();
+    asmNodesPos = asmSlotsPos = 0;
+    asmState = AsmMap_Recording;
+    samePattern = false;
+    ++patternVersion;
+    ++matrixVersion;
+}
 
-    bool reuseFailed = true;
+void KLUSystemX::KeepPrimitive(unsigned int nOrder, const unsigned int* pNodes, const complex* pMat)
+{
+    primOrders.push_back(int32_t(nOrder));
+    primNodeOffsets.push_back(int32_t(primNodes.size()));
+    primValueOffsets.push_back(int32_t(primValues.size()));
+    primNodes.insert(primNodes.end(), pNodes, pNodes + nOrder);
+    primValues.insert(primValues.end(), pMat, pMat + size_t(nOrder) * nOrder);
+    primColored = false;
+}
 
-    if ((reuseSymbolic && (options >= ReuseSymbolicFactorization)) && Symbolic)
+void KLUSystemX::ClearPrimitives(bool keepStorage)
+{
+    if (keepStorage)
     {
-        if (Numeric && (options >= ReuseNumericFactorization))
+        primNodes.clear();
+        primValues.clear();
+        primOrders.clear();
+        primNodeOffsets.clear();
+        primValueOffsets.clear();
+    }
+    else
+    {
+        primNodes = std::vector<uint32_t>();
+        primValues = std::vector<complex>();
+        primOrders = std::vector<int32_t>();
+        primNodeOffsets = std::vector<int32_t>();
+        primValueOffsets = std::vector<int32_t>();
+        primColorOrder = std::vector<uint32_t>();
+        primColorStarts = std::vector<size_t>();
+        currentsWork = std::vector<CurrentsWork>();
+    }
+    primColored = false;
+}
+
+void KLUSystemX::ColorPrimitives()
+{
+    // greedy coloring, up to 64 colors tracked as a mask for each node; the
+    // primitive matrices that don't fit are left for the sequential pass
+    const size_t nPrims = primOrders.size();
+    const uint32_t leftover = 64;
+    std::vector<uint64_t> nodeColors(m_nBus + 1, 0);
+    std::vector<uint32_t> colors(nPrims);
+    std::vector<size_t> counts(leftover + 1, 0);
+    for (size_t p = 0; p < nPrims; ++p)
+    {
+        const uint32_t* nodes = &primNodes[primNodeOffsets[p]];
+        uint64_t used = 0;
+        for (int32_t i = 0; i < primOrders[p]; ++i)
         {
-            // If refactorization has failed, run the full numeric factorization
-            switch (dataFormat)
-            {
-                case MatrixFormat_DoublePrecisionReal:
-                    reuseFailed = klu_refactor(spmat_f64.outerIndexPtr(), spmat_f64.innerIndexPtr(), reinterpret_cast<double*>(spmat_f64.valuePtr()), Symbolic, Numeric, &Common) != 1;
-                    break;
-                default:
-                    reuseFailed = klu_z_refactor(spmat.outerIndexPtr(), spmat.innerIndexPtr(), reinterpret_cast<double*>(spmat.valuePtr()), Symbolic, Numeric, &Common) != 1;
-                    break;
-            }
+            if (nodes[i])
+                used |= nodeColors[nodes[i]];
         }
-        else
+
+        uint32_t color = 0;
+        while (color < leftover && (used & (uint64_t(1) << color)))
+            ++color;
+        if (color < leftover)
         {
-            // Not allowed to reuse the numeric factorization, run the full version
-            if (Numeric)
+            for (int32_t i = 0; i < primOrders[p]; ++i)
             {
-                klu_free_numeric(&Numeric, &Common);
+                if (nodes[i])
+                    nodeColors[nodes[i]] |= uint64_t(1) << color;
             }
-            switch (dataFormat)
+        }
+        colors[p] = color;
+        ++counts[color];
+    }
+
+    // bucket by color, keeping the storage order within each; empty colors are skipped
+    std::vector<size_t> bucketOf(leftover + 1), next;
+    primColorStarts.assign(1, 0);
+    for (uint32_t color = 0; color <= leftover; ++color)
+    {
+        if (!counts[color] && color != leftover)
+            continue;
+        bucketOf[color] = next.size();
+        next.push_back(primColorStarts.back());
+        primColorStarts.push_back(primColorStarts.back() + counts[color]);
+    }
+    primColorOrder.resize(nPrims);
+    for (size_t p = 0; p < nPrims; ++p)
+        primColorOrder[next[bucketOf[colors[p]]]++] = uint32_t(p);
+
+    primColored = true;
+}
+
+template <typename T>
+void KLUSystemX::AccumulateCurrentsRange(const uint32_t* prims, size_t count, const T* pV, T* pI, CurrentsWork& work) const
+{
+    // gathers the voltages of a chunk of primitive matrices, multiplies them all
+    // with mvmult_ragged and adds the currents, staying in the cache
+    const size_t chunkSize = 64;
+    for (size_t start = 0; start < count; start += chunkSize)
+    {
+        const size_t n = std::min(chunkSize, count - start);
+        work.orders.clear();
+        work.valueOffsets.clear();
+        work.x.clear();
+        for (size_t k = start; k < start + n; ++k)
+        {
+            const uint32_t p = prims[k];
+            const uint32_t* nodes = &primNodes[primNodeOffsets[p]];
+            work.orders.push_back(primOrders[p]);
+            work.valueOffsets.push_back(primValueOffsets[p]);
+            for (int32_t i = 0; i < primOrders[p]; ++i)
+                work.x.push_back(nodes[i] ? FormatValue<T>::To(pV[nodes[i] - 1]) : complex(0));
+        }
+        work.y.resize(work.x.size());
+        mvmult_ragged(int32_t(n), work.orders.data(), nullptr, work.valueOffsets.data(),
+            reinterpret_cast<::complex*>(work.y.data()), reinterpret_cast<::complex*>(const_cast<complex*>(primValues.data())), reinterpret_cast<::complex*>(work.x.data()));
+
+        const complex* y = work.y.data();
+        for (size_t k = start; k < start + n; ++k)
+        {
+            const uint32_t p = prims[k];
+            const uint32_t* nodes = &primNodes[primNodeOffsets[p]];
+            for (int32_t i = 0; i < primOrders[p]; ++i, ++y)
             {
-                case MatrixFormat_DoublePrecisionReal:
-                    Numeric = klu_factor(spmat_f64.outerIndexPtr(), spmat_f64.innerIndexPtr(), reinterpret_cast<double*>(spmat_f64.valuePtr()), Symbolic, &Common);
-                    break;
-                default:
-                    Numeric = klu_z_factor(spmat.outerIndexPtr(), spmat.innerIndexPtr(), reinterpret_cast<double*>(spmat.valuePtr()), Symbolic, &Common);
-                    break;
+                if (nodes[i])
+                    pI[nodes[i] - 1] = FormatValue<T>::From(FormatValue<T>::To(pI[nodes[i] - 1]) + *y);
             }
-
-            if (Common.status == KLU_OK)
-                reuseFailed = false;
         }
-        // TODO: handle this? (from the manual)
-        //   "Since this can lead to numeric instability, the use of klu
-        //    rcond, klu rgrowth, or klu condest is recommended to check the
-        //    accuracy of the resulting factorization."
-        //
-        // if (!reuseFailed )
-        // {
-        // klu_z_condest(spmat.outerIndexPtr(), reinterpret_cast<double*>(spmat.valuePtr()), Symbolic, Numeric, &Common);
-        // if (Common.condest ...)
-        // {
-        // failed = true;
-        // }
-        // }
     }
+}
 
-    if (reuseFailed)
+template <typename T>
+void KLUSystemX::AccumulateCurrents(const T* pV, T* pI)
+{
+    const size_t nPrims = primOrders.size();
+    WorkerPool* pool = (flags & Option_ParallelCurrents) ? GetWorkerPool() : nullptr;
+    if (!pool)
     {
-        switch (dataFormat)
+        if (currentsWork.empty())
+            currentsWork.resize(1);
+        // in storage order
+        const size_t chunkSize = 4096;
+        uint32_t prims[chunkSize];
+        for (size_t start = 0; start < nPrims; start += chunkSize)
         {
-            case MatrixFormat_DoublePrecisionReal:
-                Symbolic = klu_analyze(spmat_f64.rows(), spmat_f64.outerIndexPtr(), spmat_f64.innerIndexPtr(), &Common);
-                Numeric = klu_factor(spmat_f64.outerIndexPtr(), spmat_f64.innerIndexPtr(), reinterpret_cast<double*>(spmat_f64.valuePtr()), Symbolic, &Common);
-                break;
-            default:
-                Symbolic = klu_analyze(spmat.rows(), spmat.outerIndexPtr(), spmat.innerIndexPtr(), &Common);
-                Numeric = klu_z_factor(spmat.outerIndexPtr(), spmat.innerIndexPtr(), reinterpret_cast<double*>(spmat.valuePtr()), Symbolic, &Common);
-                break;
+            const size_t n = std::min(chunkSize, nPrims - start);
+            std::iota(prims, prims + n, uint32_t(start));
+            AccumulateCurrentsRange(prims, n, pV, pI, currentsWork[0]);
         }
+        return;
     }
 
-    m_fltBus = Common.singular_col;
-    if (Common.singular_col < nrows)
+    if (!primColored)
+        ColorPrimitives();
+    if (currentsWork.size() < pool->GetSize())
+        currentsWork.resize(pool->GetSize());
+
+    // the colors one after the other, each split in tasks for the workers
+    const size_t taskSize = 256;
+    const size_t nColors = primColorStarts.size() - 1;
+    for (size_t color = 0; color < nColors; ++color)
     {
-        ++m_fltBus; // for 1-based NexHarm row numbers
-        // m_fltBus += 0; // skip over the voltage source buses
+        const uint32_t* prims = primColorOrder.data() + primColorStarts[color];
+        const size_t count = primColorStarts[color + 1] - primColorStarts[color];
+        if (color == nColors - 1 || count <= taskSize)
+        {
+            AccumulateCurrentsRange(prims, count, pV, pI, currentsWork[0]);
+            continue;
+        }
+        pool->Run((count + taskSize - 1) / taskSize, [&](size_t task, unsigned int worker) {
+            const size_t start = task * taskSize;
+            AccumulateCurrentsRange(prims + start, std::min(taskSize, count - start), pV, pI, currentsWork[worker]);
+        });
     }
-    else
+}
+
+int KLUSystemX::AccumulatePrimitiveCurrents(const void* pV, void* pI)
+{
+    if (!(flags & Option_KeepPrimitives))
+        return 0;
+
+    switch (dataFormat)
     {
-        m_fltBus = 0; // no singular submatrix was found
+        case MatrixFormat_DoublePrecisionReal:
+            AccumulateCurrents(static_cast<const double*>(pV), static_cast<double*>(pI));
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+            AccumulateCurrents(static_cast<const std::complex<float>*>(pV), static_cast<std::complex<float>*>(pI));
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            AccumulateCurrents(static_cast<const float*>(pV), static_cast<float*>(pI));
+            break;
+        default:
+            AccumulateCurrents(static_cast<const complex*>(pV), static_cast<complex*>(pI));
+            break;
     }
+    return 1;
+}
 
-    if (Common.status == KLU_OK)
+void KLUSystemX::BuildRowPattern(const int* Ap, const int* Ai)
+{
+    const int32_t n = int32_t(m_nX);
+    RowPattern& rp = rowPattern;
+    rp.rowStart.assign(n + 1, 0);
+    for (int32_t k = 0; k < Ap[n]; ++k)
+        ++rp.rowStart[Ai[k] + 1];
+    for (int32_t i = 0; i < n; ++i)
+        rp.rowStart[i + 1] += rp.rowStart[i];
+
+    // columns are visited in order, so each row keeps its columns sorted
+    std::vector<int32_t> next(rp.rowStart.begin(), rp.rowStart.end() - 1);
+    rp.cols.resize(Ap[n]);
+    rp.slots.resize(Ap[n]);
+    for (int32_t j = 0; j < n; ++j)
     {
-        // compute size of the factorization
-        m_NZpost += (Numeric->lnz + Numeric->unz - Numeric->n + ((Numeric->Offp) ? (Numeric->Offp[Numeric->n]) : 0));
-        return 1;
+        for (int32_t k = Ap[j]; k < Ap[j + 1]; ++k)
+        {
+            const int32_t pos = next[Ai[k]]++;
+            rp.cols[pos] = j;
+            rp.slots[pos] = k;
+        }
     }
-    else if (Common.status == KLU_SINGULAR)
+    rp.patternVersion = patternVersion;
+}
+
+template <typename MatrixT>
+double KLUSystemX::MultiplyMatrix(MatrixT& A, const typename MatrixT::Scalar* x, const typename MatrixT::Scalar* b, typename MatrixT::Scalar* y)
+{
+    typedef typename MatrixT::Scalar Scalar;
+    const int32_t n = int32_t(m_nX);
+    const bool empty = (A.outerSize() != n); // nothing assembled yet
+
+    // by rows on the workers, each output computed by a single task
+    const int32_t rowsPerTask = 8192;
+    WorkerPool* pool = ((flags & Option_ParallelMultiply) && n >= 2 * rowsPerTask && !empty) ? GetWorkerPool() : nullptr;
+    if (pool)
     {
-        return -1;
+        if (rowPattern.patternVersion != patternVersion || rowPattern.rowStart.size() != size_t(n) + 1)
+            BuildRowPattern(A.outerIndexPtr(), A.innerIndexPtr());
+
+        const size_t nTasks = (n + rowsPerTask - 1) / rowsPerTask;
+        std::vector<double> taskNorms(nTasks, 0);
+        const Scalar* values = A.valuePtr();
+        const int32_t* rowStart = rowPattern.rowStart.data();
+        const int32_t* cols = rowPattern.cols.data();
+        const int32_t* slots = rowPattern.slots.data();
+        pool->Run(nTasks, [&](size_t task, unsigned int) {
+            const int32_t end = std::min(n, int32_t(task + 1) * rowsPerTask);
+            double norm = 0;
+            for (int32_t i = int32_t(task) * rowsPerTask; i < end; ++i)
+            {
+                Scalar sum(0);
+                for (int32_t k = rowStart[i]; k < rowStart[i + 1]; ++k)
+                    sum += values[slots[k]] * x[cols[k]];
+                y[i] = b ? (b[i] - sum) : sum;
+                norm = std::max(norm, double(std::abs(y[i])));
+            }
+            taskNorms[task] = norm;
+        });
+        return *std::max_element(taskNorms.begin(), taskNorms.end());
     }
-    else
+
+    // by columns, scattering into the output
+    if (!b)
+        std::fill(y, y + n, Scalar(0));
+    else if (b != y)
+        std::copy(b, b + n, y);
+
+    const Scalar sign(b ? -1 : 1);
+    for (int32_t j = 0; j < n && !empty; ++j)
     {
-        // KLU_OUT_OF_MEMORY, KLU_INVALID, or KLU_TOO_LARGE
-        if (!m_fltBus)
-        {
-            m_fltBus = 1; // this is the flag for unsuccessful factorization
-        }
-        return 0;
+        const Scalar xj = sign * x[j];
+        for (typename MatrixT::InnerIterator it(A, j); it; ++it)
+            y[it.row()] += it.value() * xj;
     }
 
-    return 1;
+    double norm = 0;
+    for (int32_t i = 0; i < n; ++i)
+        norm = std::max(norm, double(std::abs(y[i])));
+    return norm;
 }
 
-void KLUSystemX::Solve(complex* acxVbus)
+int KLUSystemX::MultiplyMatrix(const void* pX, const void* pB, void* pY, double* pNorm)
 {
-    if (m_nX < 1)
-        return; // nothing to do
+    if (triplets.size())
+        ProcessTriplets();
+    CompressMatrix(); // for the row index, after insertions by AddElement
 
+    double norm;
     switch (dataFormat)
     {
         case MatrixFormat_DoublePrecisionReal:
-            klu_solve(Symbolic, Numeric, spmat_f64.rows(), 1, reinterpret_cast<double*>(acxVbus), &Common);
+            norm = MultiplyMatrix(spmat_f64, static_cast<const double*>(pX), static_cast<const double*>(pB), static_cast<double*>(pY));
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+            norm = MultiplyMatrix(spmat_c64, static_cast<const std::complex<float>*>(pX), static_cast<const std::complex<float>*>(pB), static_cast<std::complex<float>*>(pY));
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            norm = MultiplyMatrix(spmat_f32, static_cast<const float*>(pX), static_cast<const float*>(pB), static_cast<float*>(pY));
             break;
         default:
-            klu_z_solve(Symbolic, Numeric, spmat.rows(), 1, reinterpret_cast<double*>(acxVbus), &Common);
+            norm = MultiplyMatrix(spmat, static_cast<const complex*>(pX), static_cast<const complex*>(pB), static_cast<complex*>(pY));
             break;
     }
+    if (pNorm)
+        *pNorm = norm;
+    return 1;
 }
 
-double KLUSystemX::GetRCond()
+int32_t KLUSystemX::FindValueIndex(unsigned int iRow, unsigned int iCol)
 {
+    const int* Ap;
+    const int* Ai;
+    if (!GetPattern(Ap, Ai) || Ap[m_nX] == 0)
+        return -1;
+
+    const int* it_begin = Ai + Ap[iCol];
+    const int* it_end = Ai + Ap[iCol + 1];
+    const int* it = std::lower_bound(it_begin, it_end, int(iRow));
+    if (it == it_end || (*it != int(iRow)))
+        return -1;
+
+    return int32_t(it - Ai);
+}
+
+void KLUSystemX::ProcessTriplets()
+{
+    PhaseTimer timer(stats.assembly);
+
+    const bool keepBuffers = KeepsAssemblyBuffers();
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            stats.assembly.bytesAllocated += AssembleTriplets(spmat_f64, m_nX, triplets, assemblyWork, keepBuffers);
+            m_NZpre = spmat_f64.nonZeros();
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+            stats.assembly.bytesAllocated += AssembleTriplets(spmat_c64, m_nX, triplets, assemblyWork, keepBuffers);
+            m_NZpre = spmat_c64.nonZeros();
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            stats.assembly.bytesAllocated += AssembleTriplets(spmat_f32, m_nX, triplets, assemblyWork, keepBuffers);
+            m_NZpre = spmat_f32.nonZeros();
+            break;
+        default:
+            stats.assembly.bytesAllocated += AssembleTriplets(spmat, m_nX, triplets, assemblyWork, keepBuffers);
+            m_NZpre = spmat.nonZeros();
+            break;
+    }
+    if (keepBuffers)
+    {
+        triplets.clear();
+    }
+    else
+    {
+        triplets = std::vector<Eigen::Triplet<complex>>();
+        assemblyWork = std::vector<int32_t>();
+    }
+    ++patternVersion;
+    ++matrixVersion;
+
+    if (asmState == AsmMap_Recording)
+        BuildAssemblySlots();
+}
+
+void KLUSystemX::CompressMatrix()
+{
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            if (spmat_f64.isCompressed())
+                return;
+            spmat_f64.makeCompressed();
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+            if (spmat_c64.isCompressed())
+                return;
+            spmat_c64.makeCompressed();
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            if (spmat_f32.isCompressed())
+                return;
+            spmat_f32.makeCompressed();
+            break;
+        default:
+            if (spmat.isCompressed())
+                return;
+            spmat.makeCompressed();
+            break;
+    }
+    ++patternVersion;
+    ++matrixVersion;
+}
+
+int KLUSystemX::Factor(bool allowDeferral)
+{
+    KLUMemoryScope memoryScope(kluPool.get());
+    int32_t nrows = m_nBus;
+
+    if (asmState == AsmMap_Replaying)
+    {
+        if (asmNodesPos == asmNodes.size())
+        {
+            // all primitive matrices were replayed, the pattern is the same
+            asmState = AsmMap_Ready;
+            samePattern = true;
+            ++stats.assemblyMapHits;
+        }
+        else
+        {
+            AbandonAssemblyMap();
+        }
+    }
+
+    // first convert the triplets to column-compressed form, and prep the columns
+    if (triplets.size())
+    {
+        ProcessTriplets();
+    }
+    else if ((options != ReuseCompressedMatrix) && !(reuseSymbolic && (options >= ReuseSymbolicFactorization)) && !samePattern
+        && factorPatternVersion == patternVersion && factorMatrixVersion == matrixVersion)
+    {
+        // otherwise, compression and factoring has already been done (the
+        // triplets may also have been compressed by GetCompressedMatrix etc.)
+        if (m_fltBus)
+            return -1; // was found singular before
+        return 1; // was found okay before
+    }
+
+    // KLU needs the plain CSC arrays, an insertion by AddElement leaves the matrix uncompressed
+    CompressMatrix();
+
+    // only values changed since the last factorization, e.g. AddMatrixElement on existing entries
+    const bool valuesOnly = (factorPatternVersion == patternVersion) && (options >= ReuseSymbolicFactorization);
+    factorPatternVersion = patternVersion;
+    factorMatrixVersion = matrixVersion;
+
+    const bool keepSymbolic = (reuseSymbolic && (options >= ReuseSymbolicFactorization)) || samePattern || valuesOnly;
+    samePattern = false;
+
+    // the new factorization includes the low-rank updates
+    ClearLowRankUpdates(false);
+
+    if (allowDeferral && keepSymbolic && (flags & Option_DeferRefactorization) && !IsSinglePrecision() && !UsesBlockFactorization() && HasFactorization() && !m_fltBus)
+    {
+        // keep the previous factorization, the solves are refined against the
+        // current values and will refactor if required
+        staleFactorization = true;
+        ++stats.deferredFactorizations;
+        return 1;
+    }
+    staleFactorization = false;
+
+    if (UsesSparseLU())
+        return FactorSinglePrecision(keepSymbolic);
+
+    if (UsesBlockFactorization())
+        return FactorBlocks(keepSymbolic);
+
+    // then factor Y22
+    if (!keepSymbolic)
+    {
+        if (Symbolic)
+            klu_free_symbolic(&Symbolic, &Common);
+        Symbolic = nullptr;
+    }
+    if (!keepSymbolic || !(Numeric && (options >= ReuseNumericFactorization)))
+    {
+        if (Numeric)
+        {
+            klu_free_numeric(&Numeric, &Common); // Works for everything
+        }
+        Numeric = nullptr;
+    }
+
+    bool reuseFailed = true;
+
+    if (keepSymbolic && Symbolic)
+    {
+        if (Numeric && (options >= ReuseNumericFactorization))
+        {
+            // If refactorization has failed, run the full numeric factorization
+            reuseFailed = !RefactorNumeric();
+            if (reuseFailed)
+            {
+                ++stats.numericReuseMisses;
+            }
+            else if (!IsRefactorStable())
+            {
+                // From the manual: "Since this can lead to numeric instability, the use
+                // of klu rcond, klu rgrowth, or klu condest is recommended to check the
+                // accuracy of the resulting factorization."
+                // The old pivot order is not good enough for the new values,
+                // run the full numeric factorization to choose new pivots
+                ++nRefactorRejected;
+                ++stats.numericReuseMisses;
+                klu_free_numeric(&Numeric, &Common);
+                FactorNumeric();
+                reuseFailed = (Common.status != KLU_OK);
+            }
+            else
+            {
+                ++nRefactorAccepted;
+                ++stats.numericReuseHits;
+            }
+        }
+        else
+        {
+            // Not allowed to reuse the numeric factorization, run the full version
+            if (Numeric)
+            {
+                klu_free_numeric(&Numeric, &Common);
+            }
+            FactorNumeric();
+
+            if (Common.status == KLU_OK)
+                reuseFailed = false;
+        }
+    }
+
+    if (reuseFailed)
+    {
+        if (Numeric)
+            klu_free_numeric(&Numeric, &Common);
+        if (Symbolic)
+            klu_free_symbolic(&Symbolic, &Common);
+
+        ++stats.symbolicReuseMisses;
+        AnalyzeSymbolic();
+        if (Symbolic)
+            FactorNumeric();
+    }
+    else
+    {
+        ++stats.symbolicReuseHits;
+    }
+
+    ++factorVersion;
+    m_fltBus = Common.singular_col;
+    if (Common.singular_col < nrows)
+    {
+        ++m_fltBus; // for 1-based NexHarm row numbers
+        // m_fltBus += 0; // skip over the voltage source buses
+    }
+    else
+    {
+        m_fltBus = 0; // no singular submatrix was found
+    }
+
+    if (Common.status == KLU_OK)
+    {
+        // compute size of the factorization
+        m_NZpost = (Numeric->lnz + Numeric->unz - Numeric->n + ((Numeric->Offp) ? (Numeric->Offp[Numeric->n]) : 0));
+        return 1;
+    }
+    else if (Common.status == KLU_SINGULAR)
+    {
+        return -1;
+    }
+    else
+    {
+        // KLU_OUT_OF_MEMORY, KLU_INVALID, or KLU_TOO_LARGE
+        if (!m_fltBus)
+        {
+            m_fltBus = 1; // this is the flag for unsuccessful factorization
+        }
+        return 0;
+    }
+
+    return 1;
+}
+
+int KLUSystemX::FactorSinglePrecision(bool keepSymbolic)
+{
+    bool ok;
+    switch (dataFormat)
+    {
+        case MatrixFormat_SinglePrecisionComplex:
+            ok = FactorSparseLU(lu_c64, spmat_c64, keepSymbolic, stats);
+            m_NZpost = ok ? (lu_c64->nnzL() + lu_c64->nnzU()) : 0;
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            ok = FactorSparseLU(lu_f32, spmat_f32, keepSymbolic, stats);
+            m_NZpost = ok ? (lu_f32->nnzL() + lu_f32->nnzU()) : 0;
+            break;
+        case MatrixFormat_DoublePrecisionReal:
+            // mixed precision, the float64 matrix is kept for the refinement
+            ok = FactorSparseLU(lu_f32, SparseMatrixF32(spmat_f64.cast<float>()), keepSymbolic, stats);
+            m_NZpost = ok ? (lu_f32->nnzL() + lu_f32->nnzU()) : 0;
+            break;
+        default:
+            ok = FactorSparseLU(lu_c64, SparseMatrixC64(spmat.cast<std::complex<float> >()), keepSymbolic, stats);
+            m_NZpost = ok ? (lu_c64->nnzL() + lu_c64->nnzU()) : 0;
+            break;
+    }
+
+    ++factorVersion;
+    if (ok)
+    {
+        m_fltBus = 0;
+        return 1;
+    }
+    // SparseLU doesn't report the column, use the flag for unsuccessful factorization
+    m_fltBus = 1;
+    return -1;
+}
+
+void KLUSystemX::SolveSinglePrecision(void* pX, unsigned int nRHS, unsigned int ldim) const
+{
+    if (!HasFactorization())
+        return;
+
+    switch (dataFormat)
+    {
+        case MatrixFormat_SinglePrecisionComplex:
+            SolveSparseLU(*lu_c64, pX, m_nX, nRHS, ldim);
+            break;
+        default:
+            SolveSparseLU(*lu_f32, pX, m_nX, nRHS, ldim);
+            break;
+    }
+}
+
+void KLUSystemX::ClearFactorBlocks()
+{
+    KLUMemoryScope memoryScope(kluPool.get());
+    for (auto &b: factorBlocks)
+    {
+        if (b.Numeric)
+            klu_free_numeric(&b.Numeric, &Common);
+        if (b.Symbolic)
+            klu_free_symbolic(&b.Symbolic, &Common);
+    }
+    factorBlocks.clear();
+    blocksBySize.clear();
+}
+
+void KLUSystemX::BuildFactorBlocks()
+{
+    ClearFactorBlocks();
+
+    const int* Ap;
+    const int* Ai;
+    if (!GetPattern(Ap, Ai))
+        return;
+
+    // union-find over the entries (unlike FindIslands, this is also valid for
+    // unsymmetric patterns); the root of each component is its lowest node
+    std::vector<uint32_t> parent(m_nX);
+    std::iota(parent.begin(), parent.end(), 0);
+    auto root = [&parent](uint32_t i)
+    {
+        while (parent[i] != i)
+        {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    };
+    for (uint32_t j = 0; j < m_nX; ++j)
+    {
+        for (int p = Ap[j]; p < Ap[j + 1]; ++p)
+        {
+            const uint32_t a = root(Ai[p]), b = root(j);
+            if (a != b)
+                parent[std::max(a, b)] = std::min(a, b);
+        }
+    }
+
+    std::vector<int32_t> blockOf(m_nX, -1);
+    std::vector<int32_t> localIndex(m_nX);
+    for (uint32_t i = 0; i < m_nX; ++i)
+    {
+        const uint32_t r = root(i);
+        if (blockOf[r] < 0)
+        {
+            blockOf[r] = factorBlocks.size();
+            factorBlocks.push_back(FactorBlock());
+            factorBlocks.back().Symbolic = nullptr;
+            factorBlocks.back().Numeric = nullptr;
+            factorBlocks.back().singularCol = -1;
+        }
+        FactorBlock& b = factorBlocks[blockOf[r]];
+        localIndex[i] = b.nodes.size();
+        b.nodes.push_back(i);
+    }
+
+    const size_t entrySize = (dataFormat == MatrixFormat_DoublePrecisionReal) ? 1 : 2;
+    for (auto &b: factorBlocks)
+    {
+        b.Ap.reserve(b.nodes.size() + 1);
+        b.Ap.push_back(0);
+        for (uint32_t j: b.nodes)
+        {
+            for (int p = Ap[j]; p < Ap[j + 1]; ++p)
+            {
+                b.Ai.push_back(localIndex[Ai[p]]);
+                b.slots.push_back(p);
+            }
+            b.Ap.push_back(b.Ai.size());
+        }
+        b.Ax.resize(entrySize * b.slots.size());
+    }
+
+    // largest first, so that the parallel tasks end at about the same time
+    blocksBySize.resize(factorBlocks.size());
+    std::iota(blocksBySize.begin(), blocksBySize.end(), 0);
+    std::stable_sort(blocksBySize.begin(), blocksBySize.end(), [this](uint32_t a, uint32_t b)
+    {
+        return factorBlocks[a].nodes.size() > factorBlocks[b].nodes.size();
+    });
+}
+
+WorkerPool::WorkerPool(unsigned int nWorkers)
+    : job(nullptr)
+    , nTasks(0)
+    , nextTask(0)
+    , nBusy(0)
+    , generation(0)
+    , stopping(false)
+{
+    for (unsigned int w = 1; w < nWorkers; ++w)
+        threads.emplace_back(&WorkerPool::WorkerLoop, this, w);
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &t: threads)
+        t.join();
+}
+
+void WorkerPool::Run(size_t nTasks_, const TaskFn& fn)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &fn;
+        nTasks = nTasks_;
+        nextTask = 0;
+        nBusy = threads.size();
+        ++generation;
+    }
+    wake.notify_all();
+    RunTasks(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return nBusy == 0; });
+    job = nullptr;
+}
+
+void WorkerPool::RunTasks(unsigned int worker)
+{
+    for (size_t task = nextTask++; task < nTasks; task = nextTask++)
+        (*job)(task, worker);
+}
+
+void WorkerPool::WorkerLoop(unsigned int worker)
+{
+    uint64_t lastGeneration = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != lastGeneration; });
+            if (stopping)
+                return;
+            lastGeneration = generation;
+        }
+        RunTasks(worker);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--nBusy == 0)
+            done.notify_one();
+    }
+}
+
+WorkerPool* KLUSystemX::GetWorkerPool()
+{
+    unsigned int n = nThreads ? nThreads : std::thread::hardware_concurrency();
+    if (n <= 1)
+        return nullptr;
+
+    if (!workerPool || workerPool->GetSize() != n)
+    {
+        workerPool.reset(); // join the old threads first
+        workerPool.reset(new WorkerPool(n));
+    }
+    return workerPool.get();
+}
+
+static void AddPhaseStats(KLUSolveXPhaseStats& total, const KLUSolveXPhaseStats& part)
+{
+    if (!part.count)
+        return;
+    total.count += part.count;
+    total.totalTime += part.totalTime;
+    total.lastTime = part.lastTime;
+    total.bytesAllocated += part.bytesAllocated;
+}
+
+int KLUSystemX::FactorBlocks(bool keepSymbolic)
+{
+    if (!keepSymbolic || factorBlocks.empty())
+        BuildFactorBlocks();
+
+    const bool isComplex = (dataFormat != MatrixFormat_DoublePrecisionReal);
+    const size_t entrySize = isComplex ? 2 : 1;
+    const double* Ax = isComplex ? reinterpret_cast<const double*>(spmat.valuePtr()) : spmat_f64.valuePtr();
+
+    // gather the values, only the blocks with changes are factored again
+    std::vector<size_t> changedBlocks;
+    for (uint32_t k: blocksBySize)
+    {
+        FactorBlock& b = factorBlocks[k];
+        bool changed = (b.Numeric == nullptr);
+        for (size_t i = 0; i < b.slots.size(); ++i)
+        {
+            for (size_t t = 0; t < entrySize; ++t)
+            {
+                const double v = Ax[entrySize * b.slots[i] + t];
+                if (b.Ax[entrySize * i + t] != v)
+                {
+                    b.Ax[entrySize * i + t] = v;
+                    changed = true;
+                }
+            }
+        }
+        if (changed)
+            changedBlocks.push_back(k);
+    }
+    stats.blocksSkipped += factorBlocks.size() - changedBlocks.size();
+    stats.blocksFactored += changedBlocks.size();
+
+    // each worker has its own KLU workspace and counters, merged afterwards
+    WorkerPool* pool = ((flags & Option_ParallelFactorization) && changedBlocks.size() > 1) ? GetWorkerPool() : nullptr;
+    const unsigned int nWorkers = pool ? pool->GetSize() : 1;
+    std::vector<klu_common> commons(nWorkers, Common);
+    std::vector<KLUSolveXStats> blockStats(nWorkers);
+    for (unsigned int w = 0; w < nWorkers; ++w)
+    {
+        commons[w].memusage = 0;
+        commons[w].mempeak = 0;
+        memset(&blockStats[w], 0, sizeof(KLUSolveXStats));
+    }
+    std::vector<int> results(changedBlocks.size());
+    auto factorTask = [&](size_t task, unsigned int worker)
+    {
+        results[task] = FactorSingleBlock(factorBlocks[changedBlocks[task]], commons[worker], blockStats[worker]);
+    };
+    if (pool)
+    {
+        pool->Run(changedBlocks.size(), factorTask);
+    }
+    else
+    {
+        for (size_t task = 0; task < changedBlocks.size(); ++task)
+            factorTask(task, 0);
+    }
+
+    for (unsigned int w = 0; w < nWorkers; ++w)
+    {
+        const KLUSolveXStats& part = blockStats[w];
+        AddPhaseStats(stats.analyze, part.analyze);
+        AddPhaseStats(stats.factor, part.factor);
+        AddPhaseStats(stats.refactor, part.refactor);
+        stats.symbolicReuseHits += part.symbolicReuseHits;
+        stats.symbolicReuseMisses += part.symbolicReuseMisses;
+        stats.numericReuseHits += part.numericReuseHits;
+        stats.numericReuseMisses += part.numericReuseMisses;
+        nRefactorAccepted += part.numericReuseHits;
+        nRefactorRejected += part.numericReuseMisses;
+
+        // memusage wraps around for a worker that freed more than it allocated,
+        // the sum is still exact
+        Common.memusage += commons[w].memusage;
+        Common.mempeak = std::max(Common.mempeak, Common.memusage);
+    }
+
+    int rc = 1;
+    m_fltBus = 0;
+    m_NZpost = 0;
+    for (size_t task = 0; task < changedBlocks.size(); ++task)
+    {
+        if (!results[task])
+            rc = 0;
+    }
+    for (auto &b: factorBlocks)
+    {
+        if (rc == 0)
+            break;
+
+        if (b.singularCol >= 0 && rc == 1)
+        {
+            rc = -1;
+            m_fltBus = b.nodes[b.singularCol] + 1; // 1-based row in the system
+        }
+        const int n = b.nodes.size();
+        m_NZpost += b.Numeric->lnz + b.Numeric->unz - n + ((b.Numeric->Offp) ? (b.Numeric->Offp[n]) : 0);
+    }
+
+    ++factorVersion;
+    if (rc == 0 && !m_fltBus)
+        m_fltBus = 1; // this is the flag for unsuccessful factorization
+
+    return rc;
+}
+
+int KLUSystemX::FactorSingleBlock(FactorBlock& b, klu_common& common, KLUSolveXStats& blockStats)
+{
+    KLUMemoryScope memoryScope(kluPool.get()); // also for the worker threads
+    const bool isComplex = (dataFormat != MatrixFormat_DoublePrecisionReal);
+    const int n = b.nodes.size();
+
+    if (!b.Symbolic)
+    {
+        ++blockStats.symbolicReuseMisses;
+        PhaseTimer timer(blockStats.analyze);
+        if (orderingMethod == Ordering_Given && orderingRank.size() == m_nX)
+        {
+            // the nodes of the block, in their relative order in the given permutation
+            std::vector<int> perm(n);
+            std::iota(perm.begin(), perm.end(), 0);
+            std::sort(perm.begin(), perm.end(), [&](int i, int j) { return orderingRank[b.nodes[i]] < orderingRank[b.nodes[j]]; });
+            b.Symbolic = klu_analyze_given(n, b.Ap.data(), b.Ai.data(), perm.data(), perm.data(), &common);
+        }
+        else
+        {
+            b.Symbolic = klu_analyze(n, b.Ap.data(), b.Ai.data(), &common);
+        }
+    }
+    else
+    {
+        ++blockStats.symbolicReuseHits;
+    }
+    if (!b.Symbolic)
+        return 0;
+
+    bool refactored = false;
+    if (b.Numeric && (options >= ReuseNumericFactorization))
+    {
+        {
+            PhaseTimer timer(blockStats.refactor);
+            if (isComplex)
+                refactored = klu_z_refactor(b.Ap.data(), b.Ai.data(), b.Ax.data(), b.Symbolic, b.Numeric, &common);
+            else
+                refactored = klu_refactor(b.Ap.data(), b.Ai.data(), b.Ax.data(), b.Symbolic, b.Numeric, &common);
+        }
+        // same checks as IsRefactorStable, for this block
+        if (refactored && minRefactorRCond > 0)
+        {
+            if (isComplex)
+                klu_z_rcond(b.Symbolic, b.Numeric, &common);
+            else
+                klu_rcond(b.Symbolic, b.Numeric, &common);
+            refactored = (common.rcond >= minRefactorRCond);
+        }
+        if (refactored && minRefactorRGrowth > 0)
+        {
+            if (isComplex)
+                klu_z_rgrowth(b.Ap.data(), b.Ai.data(), b.Ax.data(), b.Symbolic, b.Numeric, &common);
+            else
+                klu_rgrowth(b.Ap.data(), b.Ai.data(), b.Ax.data(), b.Symbolic, b.Numeric, &common);
+            refactored = (common.rgrowth >= minRefactorRGrowth);
+        }
+        if (refactored)
+            ++blockStats.numericReuseHits;
+        else
+            ++blockStats.numericReuseMisses;
+    }
+    if (!refactored)
+    {
+        if (b.Numeric)
+            klu_free_numeric(&b.Numeric, &common);
+
+        PhaseTimer timer(blockStats.factor);
+        if (isComplex)
+            b.Numeric = klu_z_factor(b.Ap.data(), b.Ai.data(), b.Ax.data(), b.Symbolic, &common);
+        else
+            b.Numeric = klu_factor(b.Ap.data(), b.Ai.data(), b.Ax.data(), b.Symbolic, &common);
+    }
+
+    if (!b.Numeric || (common.status != KLU_OK && common.status != KLU_SINGULAR))
+        return 0;
+
+    b.singularCol = (common.status == KLU_SINGULAR && common.singular_col < n) ? common.singular_col : -1;
+    return 1;
+}
+
+void KLUSystemX::SolveBlock(size_t k, void* pX, unsigned int nRHS, unsigned int ldim, klu_numeric* numeric, klu_common* pCommon, std::vector<double>& work) const
+{
+    const bool isComplex = (dataFormat != MatrixFormat_DoublePrecisionReal);
+    const size_t entrySize = isComplex ? 2 : 1;
+    double* X = static_cast<double*>(pX);
+
+    const FactorBlock& b = factorBlocks[k];
+    const size_t n = b.nodes.size();
+    work.resize(entrySize * n * nRHS);
+
+    for (unsigned int c = 0; c < nRHS; ++c)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            for (size_t t = 0; t < entrySize; ++t)
+                work[entrySize * (i + n * c) + t] = X[entrySize * (b.nodes[i] + size_t(ldim) * c) + t];
+        }
+    }
+
+    if (isComplex)
+        klu_z_solve(b.Symbolic, numeric, n, nRHS, work.data(), pCommon);
+    else
+        klu_solve(b.Symbolic, numeric, n, nRHS, work.data(), pCommon);
+
+    for (unsigned int c = 0; c < nRHS; ++c)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            for (size_t t = 0; t < entrySize; ++t)
+                X[entrySize * (b.nodes[i] + size_t(ldim) * c) + t] = work[entrySize * (i + n * c) + t];
+        }
+    }
+}
+
+void KLUSystemX::SolveBlocks(void* pX, unsigned int nRHS, unsigned int ldim, klu_numeric* const* pNumerics, klu_common* pCommon, std::vector<double>& work) const
+{
+    for (size_t k = 0; k < factorBlocks.size(); ++k)
+        SolveBlock(k, pX, nRHS, ldim, pNumerics ? pNumerics[k] : factorBlocks[k].Numeric, pCommon, work);
+}
+
+void KLUSystemX::SolveBlocksParallel(void* pX, unsigned int nRHS, unsigned int ldim)
+{
+    // below this, waking up the threads costs about as much as the solves
+    const size_t minParallelEntries = 4096;
+
+    WorkerPool* pool = (factorBlocks.size() > 1 && size_t(m_nX) * nRHS >= minParallelEntries) ? GetWorkerPool() : nullptr;
+    if (!pool)
+    {
+        SolveBlocks(pX, nRHS, ldim, nullptr, &Common, blockWork);
+        return;
+    }
+
+    // the blocks have disjoint nodes, so each task scatters and gathers its own part of pX
+    const unsigned int nWorkers = pool->GetSize();
+    std::vector<klu_common> commons(nWorkers, Common);
+    workerBlockWork.resize(nWorkers);
+    pool->Run(factorBlocks.size(), [&](size_t task, unsigned int worker)
+    {
+        const size_t k = blocksBySize[task];
+        SolveBlock(k, pX, nRHS, ldim, factorBlocks[k].Numeric, &commons[worker], workerBlockWork[worker]);
+    });
+}
+
+unsigned int KLUSystemX::SolveRefined(void* pXB, klu_numeric* pNumeric, klu_common* pCommon, std::vector<complex>& work, double& residual) const
+{
+    if (!HasFactorization())
+    {
+        residual = std::numeric_limits<double>::infinity();
+        return 0;
+    }
+
+    const KLUColumnSolver kluSolver = { Symbolic, pNumeric, pCommon, int(m_nX) };
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+        {
+            work.resize(m_nX); // room for 2*n float64 values
+            double* x = static_cast<double*>(pXB);
+            double* b = reinterpret_cast<double*>(work.data());
+            if (flags & Option_MixedPrecisionFactor)
+            {
+                const LoweredColumnSolver<SparseLUF32> luSolver = { *lu_f32 };
+                return RefineSolution(spmat_f64, x, b, b + m_nX, luSolver, maxRefinementIterations, refinementTolerance, residual);
+            }
+            return RefineSolution(spmat_f64, x, b, b + m_nX, kluSolver, maxRefinementIterations, refinementTolerance, residual);
+        }
+        default:
+        {
+            work.resize(2 * size_t(m_nX));
+            complex* x = static_cast<complex*>(pXB);
+            complex* b = work.data();
+            if (flags & Option_MixedPrecisionFactor)
+            {
+                const LoweredColumnSolver<SparseLUC64> luSolver = { *lu_c64 };
+                return RefineSolution(spmat, x, b, b + m_nX, luSolver, maxRefinementIterations, refinementTolerance, residual);
+            }
+            return RefineSolution(spmat, x, b, b + m_nX, kluSolver, maxRefinementIterations, refinementTolerance, residual);
+        }
+    }
+}
+
+void KLUSystemX::SolveRefined(complex* acxVbus, unsigned int nRHS, unsigned int ldim)
+{
+    const size_t entrySize = GetEntrySize();
+    lastRefinementIterations = 0;
+    lastRefinementResidual = 0;
+
+    for (unsigned int c = 0; c < nRHS; ++c)
+    {
+        void* pCol = reinterpret_cast<char*>(acxVbus) + entrySize * size_t(ldim) * c;
+        double residual;
+        unsigned int nSteps = SolveRefined(pCol, Numeric, &Common, refineWork, residual);
+        if (!(residual <= refinementTolerance) && staleFactorization)
+        {
+            // the deferred factorization is too far from the current values,
+            // refactor and start again from the original right-hand side
+            ++stats.deferredFallbacks;
+            samePattern = true;
+            if (Factor(false) != 1)
+            {
+                bFactored = false;
+                lastRefinementResidual = residual;
+                return;
+            }
+            memcpy(pCol, refineWork.data(), entrySize * m_nX);
+            nSteps += SolveRefined(pCol, Numeric, &Common, refineWork, residual);
+        }
+        stats.refinementSteps += nSteps;
+        lastRefinementIterations = std::max(lastRefinementIterations, nSteps);
+        lastRefinementResidual = std::max(lastRefinementResidual, residual);
+    }
+}
+
+void KLUSystemX::AnalyzeSymbolic()
+{
+    KLUMemoryScope memoryScope(kluPool.get());
+    PhaseTimer timer(stats.analyze);
+    const size_t memBefore = Common.memusage;
+
+    const int* Ap;
+    const int* Ai;
+    if (!GetPattern(Ap, Ai))
+    {
+        // Factor compresses the matrix first, the arrays are not valid CSC otherwise
+        Symbolic = nullptr;
+        Common.status = KLU_INVALID;
+        return;
+    }
+
+    if (!givenOrdering.P.empty() && givenOrdering.n == m_nX && GetPatternHash() == givenOrdering.patternHash)
+    {
+        // ordering from LoadSymbolic; without BTF, klu_analyze_given keeps P and Q
+        // as given, in a single block, and the saved blocks are restored on it
+        const int btf = Common.btf;
+        Common.btf = 0;
+        Symbolic = klu_analyze_given(m_nX, const_cast<int*>(Ap), const_cast<int*>(Ai), givenOrdering.P.data(), givenOrdering.Q.data(), &Common);
+        Common.btf = btf;
+        if (Symbolic && givenOrdering.R.size() > 2)
+            ApplyGivenBlocks(Ap, Ai);
+
+        ++stats.symbolicGiven;
+    }
+    else if (orderingMethod == Ordering_Given && orderingPerm.size() == m_nX)
+    {
+        Symbolic = klu_analyze_given(m_nX, const_cast<int*>(Ap), const_cast<int*>(Ai), orderingPerm.data(), orderingPerm.data(), &Common);
+    }
+    else
+    {
+        switch (dataFormat)
+        {
+            case MatrixFormat_DoublePrecisionReal:
+                Symbolic = klu_analyze(spmat_f64.rows(), spmat_f64.outerIndexPtr(), spmat_f64.innerIndexPtr(), &Common);
+                break;
+            default:
+                Symbolic = klu_analyze(spmat.rows(), spmat.outerIndexPtr(), spmat.innerIndexPtr(), &Common);
+                break;
+        }
+    }
+    if (Common.memusage > memBefore)
+        stats.analyze.bytesAllocated += Common.memusage - memBefore;
+}
+
+bool KLUSystemX::ApplyGivenBlocks(const int* Ap, const int* Ai)
+{
+    const std::vector<int>& R = givenOrdering.R;
+    const int nblocks = int(R.size()) - 1;
+    std::vector<int> Pinv(m_nX), blockOf(m_nX);
+    for (uint32_t k = 0; k < m_nX; ++k)
+        Pinv[givenOrdering.P[k]] = k;
+
+    int maxblock = 1;
+    for (int b = 0; b < nblocks; ++b)
+    {
+        maxblock = std::max(maxblock, R[b + 1] - R[b]);
+        for (int k = R[b]; k < R[b + 1]; ++k)
+            blockOf[k] = b;
+    }
+
+    // A(P, Q) must be block upper triangular; KLU keeps the entries above the
+    // diagonal blocks apart, and allocates them from nzoff
+    int nzoff = 0;
+    for (uint32_t k = 0; k < m_nX; ++k)
+    {
+        const int j = givenOrdering.Q[k];
+        for (int p = Ap[j]; p < Ap[j + 1]; ++p)
+        {
+            const int row = Pinv[Ai[p]];
+            if (row >= R[blockOf[k] + 1])
+                return false;
+            if (row < R[blockOf[k]])
+                ++nzoff;
+        }
+    }
+
+    Symbolic->nblocks = nblocks;
+    Symbolic->maxblock = maxblock;
+    Symbolic->nzoff = nzoff;
+    Symbolic->do_btf = 1;
+    for (int b = 0; b < nblocks; ++b)
+    {
+        Symbolic->R[b] = R[b];
+        Symbolic->Lnz[b] = -1; // no fill estimate, as with a user ordering
+    }
+    Symbolic->R[nblocks] = R[nblocks];
+    return true;
+}
+
+void KLUSystemX::FactorNumeric()
+{
+    KLUMemoryScope memoryScope(kluPool.get());
+    PhaseTimer timer(stats.factor);
+    const size_t memBefore = Common.memusage;
+
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            Numeric = klu_factor(spmat_f64.outerIndexPtr(), spmat_f64.innerIndexPtr(), reinterpret_cast<double*>(spmat_f64.valuePtr()), Symbolic, &Common);
+            break;
+        default:
+            Numeric = klu_z_factor(spmat.outerIndexPtr(), spmat.innerIndexPtr(), reinterpret_cast<double*>(spmat.valuePtr()), Symbolic, &Common);
+            break;
+    }
+    if (Common.memusage > memBefore)
+        stats.factor.bytesAllocated += Common.memusage - memBefore;
+}
+
+bool KLUSystemX::RefactorNumeric()
+{
+    PhaseTimer timer(stats.refactor);
+
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            return klu_refactor(spmat_f64.outerIndexPtr(), spmat_f64.innerIndexPtr(), reinterpret_cast<double*>(spmat_f64.valuePtr()), Symbolic, Numeric, &Common) == 1;
+        default:
+            return klu_z_refactor(spmat.outerIndexPtr(), spmat.innerIndexPtr(), reinterpret_cast<double*>(spmat.valuePtr()), Symbolic, Numeric, &Common) == 1;
+    }
+}
+
+void KLUSystemX::GetStats(KLUSolveXStats* pStats)
+{
+    *pStats = stats;
+    pStats->kluMemoryUsage = Common.memusage;
+    pStats->kluMemoryPeak = Common.mempeak;
+    if (kluPool)
+        kluPool->GetStats(*pStats);
+}
+
+void KLUSystemX::ResetStats()
+{
+    memset(&stats, 0, sizeof(stats));
+    if (kluPool)
+        kluPool->ResetCounters();
+}
+
+void KLUSystemX::UpdateKLUMemoryPool()
+{
+    const bool enable = (flags & Option_PooledKLUMemory) != 0;
+    if (enable && !kluPool)
+        kluPool.reset(new KLUMemoryPool());
+    if (kluPool)
+        kluPool->SetPooling(enable);
+}
+
+bool KLUSystemX::IsRefactorStable()
+{
+    // rcond is a cheap estimate, based only on the diagonal of U
+    if (minRefactorRCond > 0 && GetRCond() < minRefactorRCond)
+        return false;
+
+    if (minRefactorRGrowth > 0)
+    {
+        const double rgrowth = GetRGrowth();
+        if (rgrowth >= 0 && rgrowth < minRefactorRGrowth)
+            return false;
+    }
+    return true;
+}
+
+void KLUSystemX::Solve(complex* acxVbus)
+{
+    if (m_nX < 1)
+        return; // nothing to do
+
+    PhaseTimer timer(stats.solve);
+
+    if (IsRefinementRequired())
+    {
+        SolveRefined(acxVbus, 1, m_nX);
+        return;
+    }
+    lastRefinementIterations = 0;
+    lastRefinementResidual = 0;
+
+    if (UsesBlockFactorization())
+    {
+        if (flags & Option_ParallelSolve)
+            SolveBlocksParallel(acxVbus, 1, m_nX);
+        else
+            SolveBlocks(acxVbus, 1, m_nX, nullptr, &Common, blockWork);
+        return;
+    }
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            klu_solve(Symbolic, Numeric, spmat_f64.rows(), 1, reinterpret_cast<double*>(acxVbus), &Common);
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+        case MatrixFormat_SinglePrecisionReal:
+            SolveSinglePrecision(acxVbus, 1, m_nX);
+            break;
+        default:
+            klu_z_solve(Symbolic, Numeric, spmat.rows(), 1, reinterpret_cast<double*>(acxVbus), &Common);
+            break;
+    }
+    ApplyLowRankCorrection(acxVbus, 1, m_nX);
+}
+
+void KLUSystemX::Solve(complex* acxVbus, unsigned int nRHS, unsigned int ldim)
+{
+    if (m_nX < 1 || nRHS < 1)
+        return; // nothing to do
+
+    PhaseTimer timer(stats.solve);
+
+    if (IsRefinementRequired())
+    {
+        SolveRefined(acxVbus, nRHS, ldim);
+        return;
+    }
+    lastRefinementIterations = 0;
+    lastRefinementResidual = 0;
+
+    if (UsesBlockFactorization())
+    {
+        if (flags & Option_ParallelSolve)
+            SolveBlocksParallel(acxVbus, nRHS, ldim);
+        else
+            SolveBlocks(acxVbus, nRHS, ldim, nullptr, &Common, blockWork);
+        return;
+    }
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            klu_solve(Symbolic, Numeric, ldim, nRHS, reinterpret_cast<double*>(acxVbus), &Common);
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+        case MatrixFormat_SinglePrecisionReal:
+            SolveSinglePrecision(acxVbus, nRHS, ldim);
+            break;
+        default:
+            klu_z_solve(Symbolic, Numeric, ldim, nRHS, reinterpret_cast<double*>(acxVbus), &Common);
+            break;
+    }
+    ApplyLowRankCorrection(acxVbus, nRHS, ldim);
+}
+
+// reads/writes entry k of a vector in the element type of the given format
+static complex GetEntry(uint32_t dataFormat, const void* p, size_t k)
+{
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            return FormatValue<double>::To(static_cast<const double*>(p)[k]);
+        case MatrixFormat_SinglePrecisionComplex:
+            return FormatValue<std::complex<float> >::To(static_cast<const std::complex<float>*>(p)[k]);
+        case MatrixFormat_SinglePrecisionReal:
+            return FormatValue<float>::To(static_cast<const float*>(p)[k]);
+        default:
+            return static_cast<const complex*>(p)[k];
+    }
+}
+
+static void SetEntry(uint32_t dataFormat, void* p, size_t k, const complex& v)
+{
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            static_cast<double*>(p)[k] = FormatValue<double>::From(v);
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+            static_cast<std::complex<float>*>(p)[k] = FormatValue<std::complex<float> >::From(v);
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            static_cast<float*>(p)[k] = FormatValue<float>::From(v);
+            break;
+        default:
+            static_cast<complex*>(p)[k] = v;
+            break;
+    }
+}
+
+// pattern of the transpose of a compressed n x n matrix
+static void TransposePattern(int n, const std::vector<int>& Ap, const std::vector<int>& Ai, std::vector<int>& Tp, std::vector<int>& Ti)
+{
+    Tp.assign(n + 1, 0);
+    Ti.resize(Ap[n]);
+    for (int p = 0; p < Ap[n]; ++p)
+        ++Tp[Ai[p] + 1];
+    for (int i = 0; i < n; ++i)
+        Tp[i + 1] += Tp[i];
+
+    std::vector<int> next(Tp.begin(), Tp.end() - 1);
+    for (int j = 0; j < n; ++j)
+    {
+        for (int p = Ap[j]; p < Ap[j + 1]; ++p)
+            Ti[next[Ai[p]]++] = j;
+    }
+}
+
+/* Depth-first search from the seeds through the graph of a compressed matrix
+(column j to the rows of column j), skipping the nodes rejected by allowed().
+The nodes are listed in postorder, a triangular solve processes them in reverse
+(Gilbert-Peierls). Iterative, the paths can be as long as the matrix.
+*/
+template <typename AllowedFn>
+static void SparseReach(const std::vector<int>& Gp, const std::vector<int>& Gi, const std::vector<int>& seeds, AllowedFn allowed,
+    std::vector<uint32_t>& reached, uint32_t stamp, std::vector<int>& stack, std::vector<int>& pos, std::vector<int>& order)
+{
+    order.clear();
+    for (int s: seeds)
+    {
+        if (reached[s] == stamp || !allowed(s))
+            continue;
+
+        reached[s] = stamp;
+        pos[s] = Gp[s];
+        stack.push_back(s);
+        while (!stack.empty())
+        {
+            const int j = stack.back();
+            bool descended = false;
+            while (pos[j] < Gp[j + 1])
+            {
+                const int i = Gi[pos[j]++];
+                if (reached[i] == stamp || !allowed(i))
+                    continue;
+
+                reached[i] = stamp;
+                pos[i] = Gp[i];
+                stack.push_back(i);
+                descended = true;
+                break;
+            }
+            if (!descended)
+            {
+                stack.pop_back();
+                order.push_back(j);
+            }
+        }
+    }
+}
+
+// Woodbury correction of the requested entries only; xCols: solution of the
+// factored system at the changed columns
+template <typename Scalar>
+static void CorrectEntries(const LowRankCorrection<Scalar>& lr, const std::vector<complex>& xCols, unsigned int nOut, const unsigned int* idxOut, std::vector<complex>& out)
+{
+    typedef typename LowRankCorrection<Scalar>::Vector Vector;
+    Vector t(xCols.size());
+    for (size_t k = 0; k < xCols.size(); ++k)
+        t[k] = FormatValue<Scalar>::From(xCols[k]);
+
+    const Vector y = lr.K.solve(t);
+    for (unsigned int k = 0; k < nOut; ++k)
+        out[k] -= FormatValue<Scalar>::To((lr.W.row(idxOut[k]) * y).value());
+}
+
+bool KLUSystemX::ExtractFactors()
+{
+    ExtractedFactors& f = sparseFactors;
+    if (f.valid && f.factorVersion == factorVersion)
+        return true;
+
+    f.valid = false;
+    if (!Symbolic || !Numeric)
+        return false;
+
+    // KLU keeps the factors in its packed per-block format, only accessible through klu_extract
+    const int n = Numeric->n;
+    const int lnz = Numeric->lnz, unz = Numeric->unz, nzoff = Numeric->nzoff;
+    f.Lp.resize(n + 1);
+    f.Li.resize(lnz);
+    f.Up.resize(n + 1);
+    f.Ui.resize(unz);
+    f.Fp.resize(n + 1);
+    f.Fi.resize(nzoff);
+    f.Rs.resize(n);
+    std::vector<int> P(n), Q(n), R(Symbolic->nblocks + 1);
+    std::vector<double> Lx(lnz), Ux(unz), Fx(nzoff);
+    std::vector<double> Lz, Uz, Fz;
+
+    int ok;
+    if (dataFormat == MatrixFormat_DoublePrecisionReal)
+    {
+        ok = klu_extract(Numeric, Symbolic, f.Lp.data(), f.Li.data(), Lx.data(), f.Up.data(), f.Ui.data(), Ux.data(),
+            f.Fp.data(), f.Fi.data(), Fx.data(), P.data(), Q.data(), f.Rs.data(), R.data(), &Common);
+    }
+    else
+    {
+        Lz.resize(lnz);
+        Uz.resize(unz);
+        Fz.resize(nzoff);
+        ok = klu_z_extract(Numeric, Symbolic, f.Lp.data(), f.Li.data(), Lx.data(), Lz.data(), f.Up.data(), f.Ui.data(), Ux.data(), Uz.data(),
+            f.Fp.data(), f.Fi.data(), Fx.data(), Fz.data(), P.data(), Q.data(), f.Rs.data(), R.data(), &Common);
+    }
+    if (!ok)
+        return false;
+
+    auto combine = [](const std::vector<double>& re, const std::vector<double>& im, std::vector<complex>& values)
+    {
+        values.resize(re.size());
+        for (size_t k = 0; k < re.size(); ++k)
+            values[k] = complex(re[k], im.empty() ? 0.0 : im[k]);
+    };
+    combine(Lx, Lz, f.Lx);
+    combine(Ux, Uz, f.Ux);
+    combine(Fx, Fz, f.Fx);
+
+    f.Pinv.resize(n);
+    f.Qinv.resize(n);
+    for (int k = 0; k < n; ++k)
+    {
+        f.Pinv[P[k]] = k;
+        f.Qinv[Q[k]] = k;
+    }
+    f.blockOf.resize(n);
+    for (int b = 0; b < Symbolic->nblocks; ++b)
+        std::fill(f.blockOf.begin() + R[b], f.blockOf.begin() + R[b + 1], b);
+
+    f.Udiag.assign(n, -1);
+    for (int j = 0; j < n; ++j)
+    {
+        for (int p = f.Up[j]; p < f.Up[j + 1]; ++p)
+        {
+            if (f.Ui[p] == j)
+            {
+                f.Udiag[j] = p;
+                break;
+            }
+        }
+    }
+    TransposePattern(n, f.Lp, f.Li, f.Ltp, f.Lti);
+    TransposePattern(n, f.Up, f.Ui, f.Utp, f.Uti);
+    TransposePattern(n, f.Fp, f.Fi, f.Ftp, f.Fti);
+
+    f.factorVersion = factorVersion;
+    f.valid = true;
+    return true;
+}
+
+int KLUSystemX::SolveSparseRHS(unsigned int nnzB, const unsigned int* idxB, const void* valB, unsigned int nOut, const unsigned int* idxOut, void* valOut)
+{
+    for (unsigned int k = 0; k < nnzB; ++k)
+    {
+        if (idxB[k] >= m_nX)
+            return 0;
+    }
+    for (unsigned int k = 0; k < nOut; ++k)
+    {
+        if (idxOut[k] >= m_nX)
+            return 0;
+    }
+    if (nOut == 0)
+        return 1;
+
+    if (UsesSparseLU() || UsesBlockFactorization() || IsRefinementRequired() || !ExtractFactors())
+    {
+        // no factors to traverse, solve for the whole vector; complex entries fit all formats
+        std::vector<complex> dense(m_nX);
+        for (unsigned int k = 0; k < nnzB; ++k)
+            SetEntry(dataFormat, dense.data(), idxB[k], GetEntry(dataFormat, dense.data(), idxB[k]) + GetEntry(dataFormat, valB, k));
+
+        Solve(dense.data());
+        for (unsigned int k = 0; k < nOut; ++k)
+            SetEntry(dataFormat, valOut, k, GetEntry(dataFormat, dense.data(), idxOut[k]));
+
+        return 1;
+    }
+
+    PhaseTimer timer(stats.solve);
+    lastRefinementIterations = 0;
+    lastRefinementResidual = 0;
+
+    const ExtractedFactors& f = sparseFactors;
+    SparseSolveWork& w = sparseWork;
+    if (w.x.size() != m_nX)
+    {
+        w = SparseSolveWork();
+        w.x.resize(m_nX);
+        w.pos.resize(m_nX);
+    }
+    if (++w.stamp == 1 || w.stamp == 0)
+    {
+        // first use or wrapped around
+        for (auto marks: { &w.nonZero, &w.neededX, &w.neededY, &w.reachedL, &w.reachedU })
+            marks->assign(m_nX, 0);
+        w.stamp = 1;
+    }
+    const uint32_t stamp = w.stamp;
+
+    // The entries needed for the outputs: each solution entry needs its forward
+    // solve entry and the solution entries in its row of U; each forward solve
+    // entry needs those in its row of L, and the solution entries in its row of F
+    const std::vector<uint32_t>& lrCols = (dataFormat == MatrixFormat_DoublePrecisionReal) ? lrReal.cols : lrComplex.cols;
+    auto needX = [&](int i)
+    {
+        if (w.neededX[i] != stamp)
+        {
+            w.neededX[i] = stamp;
+            w.pendingX.push_back(i);
+        }
+    };
+    auto needY = [&](int i)
+    {
+        if (w.neededY[i] != stamp)
+        {
+            w.neededY[i] = stamp;
+            w.pendingY.push_back(i);
+        }
+    };
+    for (unsigned int k = 0; k < nOut; ++k)
+        needX(f.Qinv[idxOut[k]]);
+    for (uint32_t col: lrCols)
+        needX(f.Qinv[col]);
+
+    while (!w.pendingX.empty() || !w.pendingY.empty())
+    {
+        if (!w.pendingX.empty())
+        {
+            const int i = w.pendingX.back();
+            w.pendingX.pop_back();
+            needY(i);
+            for (int p = f.Utp[i]; p < f.Utp[i + 1]; ++p)
+                needX(f.Uti[p]);
+        }
+        else
+        {
+            const int i = w.pendingY.back();
+            w.pendingY.pop_back();
+            for (int p = f.Ltp[i]; p < f.Ltp[i + 1]; ++p)
+                needY(f.Lti[p]);
+            for (int p = f.Ftp[i]; p < f.Ftp[i + 1]; ++p)
+                needX(f.Fti[p]);
+        }
+    }
+
+    // scaled and permuted right-hand side, grouped by block; KLU solves
+    // the blocks from last to first, each updating the earlier ones through F
+    std::map<int, std::vector<int>, std::greater<int> > activeBlocks;
+    auto touch = [&](int i)
+    {
+        if (w.nonZero[i] != stamp)
+        {
+            w.nonZero[i] = stamp;
+            w.x[i] = 0;
+            activeBlocks[f.blockOf[i]].push_back(i);
+        }
+    };
+    for (unsigned int k = 0; k < nnzB; ++k)
+    {
+        const int i = f.Pinv[idxB[k]];
+        if (w.neededY[i] != stamp)
+            continue;
+
+        touch(i);
+        w.x[i] += GetEntry(dataFormat, valB, k) / f.Rs[idxB[k]];
+    }
+
+    auto isNeededX = [&](int i) { return w.neededX[i] == stamp; };
+    auto isNeededY = [&](int i) { return w.neededY[i] == stamp; };
+    while (!activeBlocks.empty())
+    {
+        w.seeds.swap(activeBlocks.begin()->second);
+        activeBlocks.erase(activeBlocks.begin());
+
+        // forward solve with the unit lower triangular L, over the reach of the non-zeros
+        SparseReach(f.Lp, f.Li, w.seeds, isNeededY, w.reachedL, stamp, w.stack, w.pos, w.order);
+        for (int j: w.order)
+        {
+            if (w.nonZero[j] != stamp)
+            {
+                w.nonZero[j] = stamp;
+                w.x[j] = 0;
+            }
+        }
+        for (auto it = w.order.rbegin(); it != w.order.rend(); ++it)
+        {
+            const int j = *it;
+            const complex xj = w.x[j];
+            for (int p = f.Lp[j]; p < f.Lp[j + 1]; ++p)
+            {
+                const int i = f.Li[p];
+                if (i != j && isNeededY(i))
+                    w.x[i] -= f.Lx[p] * xj;
+            }
+        }
+
+        // backward solve with U, only for the needed entries
+        w.seeds.swap(w.order);
+        SparseReach(f.Up, f.Ui, w.seeds, isNeededX, w.reachedU, stamp, w.stack, w.pos, w.order);
+        for (int j: w.order)
+        {
+            if (w.nonZero[j] != stamp)
+            {
+                w.nonZero[j] = stamp;
+                w.x[j] = 0;
+            }
+        }
+        for (auto it = w.order.rbegin(); it != w.order.rend(); ++it)
+        {
+            const int j = *it;
+            w.x[j] /= f.Ux[f.Udiag[j]];
+            const complex xj = w.x[j];
+            for (int p = f.Up[j]; p < f.Up[j + 1]; ++p)
+            {
+                const int i = f.Ui[p];
+                if (i != j && isNeededX(i))
+                    w.x[i] -= f.Ux[p] * xj;
+            }
+        }
+
+        // off-diagonal blocks
+        for (int j: w.order)
+        {
+            const complex xj = w.x[j];
+            for (int p = f.Fp[j]; p < f.Fp[j + 1]; ++p)
+            {
+                const int i = f.Fi[p];
+                if (!isNeededY(i))
+                    continue;
+
+                touch(i);
+                w.x[i] -= f.Fx[p] * xj;
+            }
+        }
+    }
+
+    auto solution = [&](uint32_t col)
+    {
+        const int j = f.Qinv[col];
+        return (w.nonZero[j] == stamp) ? w.x[j] : complex(0);
+    };
+    std::vector<complex> out(nOut);
+    for (unsigned int k = 0; k < nOut; ++k)
+        out[k] = solution(idxOut[k]);
+
+    if (!lrCols.empty())
+    {
+        std::vector<complex> xCols(lrCols.size());
+        for (size_t k = 0; k < lrCols.size(); ++k)
+            xCols[k] = solution(lrCols[k]);
+
+        if (dataFormat == MatrixFormat_DoublePrecisionReal)
+            CorrectEntries(lrReal, xCols, nOut, idxOut, out);
+        else
+            CorrectEntries(lrComplex, xCols, nOut, idxOut, out);
+    }
+    for (unsigned int k = 0; k < nOut; ++k)
+        SetEntry(dataFormat, valOut, k, out[k]);
+
+    return 1;
+}
+
+double KLUSystemX::GetRCond()
+{
+    if (UsesSparseLU())
+        return -1; // not available with Eigen's SparseLU
+
+    if (UsesBlockFactorization())
+    {
+        // the worst block
+        double rcond = -1;
+        for (auto &b: factorBlocks)
+        {
+            if (!b.Numeric)
+                continue;
+            if (dataFormat == MatrixFormat_DoublePrecisionReal)
+                klu_rcond(b.Symbolic, b.Numeric, &Common);
+            else
+                klu_z_rcond(b.Symbolic, b.Numeric, &Common);
+            if (rcond < 0 || Common.rcond < rcond)
+                rcond = Common.rcond;
+        }
+        return rcond;
+    }
+
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            klu_rcond(Symbolic, Numeric, &Common);
+            break;
+        default:
+            klu_z_rcond(Symbolic, Numeric, &Common);
+            break;
+    }
+    return Common.rcond;
+}
+
+double KLUSystemX::GetRGrowth()
+{
+    if (UsesSparseLU())
+        return -1; // not available with Eigen's SparseLU
+
+    if (UsesBlockFactorization())
+    {
+        // the worst block
+        double rgrowth = -1;
+        for (auto &b: factorBlocks)
+        {
+            if (!b.Numeric)
+                continue;
+            int ok;
+            if (dataFormat == MatrixFormat_DoublePrecisionReal)
+                ok = klu_rgrowth(const_cast<int*>(b.Ap.data()), const_cast<int*>(b.Ai.data()), const_cast<double*>(b.Ax.data()), b.Symbolic, b.Numeric, &Common);
+            else
+                ok = klu_z_rgrowth(const_cast<int*>(b.Ap.data()), const_cast<int*>(b.Ai.data()), const_cast<double*>(b.Ax.data()), b.Symbolic, b.Numeric, &Common);
+            if (ok && (rgrowth < 0 || Common.rgrowth < rgrowth))
+                rgrowth = Common.rgrowth;
+        }
+        return rgrowth;
+    }
+
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            if (spmat_f64.rows() == 0)
+                return 0.0;
+            if (klu_rgrowth(spmat_f64.outerIndexPtr(), spmat_f64.innerIndexPtr(), reinterpret_cast<double*>(spmat_f64.valuePtr()), Symbolic, Numeric, &Common) == 1)
+                return Common.rgrowth;
+            break;
+        default:
+            if (spmat.rows() == 0)
+                return 0.0;
+            if (klu_z_rgrowth(spmat.outerIndexPtr(), spmat.innerIndexPtr(), reinterpret_cast<double*>(spmat.valuePtr()), Symbolic, Numeric, &Common) == 1)
+                return Common.rgrowth;
+            break;
+    }
+    return -1;
+}
+
+double KLUSystemX::GetCondEst()
+{
+    if (UsesSparseLU())
+        return -1; // not available with Eigen's SparseLU
+
+    if (UsesBlockFactorization())
+    {
+        // the worst block
+        double condest = 0;
+        for (auto &b: factorBlocks)
+        {
+            if (!b.Numeric)
+                continue;
+            if (dataFormat == MatrixFormat_DoublePrecisionReal)
+                klu_condest(const_cast<int*>(b.Ap.data()), const_cast<double*>(b.Ax.data()), b.Symbolic, b.Numeric, &Common);
+            else
+                klu_z_condest(const_cast<int*>(b.Ap.data()), const_cast<double*>(b.Ax.data()), b.Symbolic, b.Numeric, &Common);
+            condest = std::max(condest, Common.condest);
+        }
+        return condest;
+    }
+
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            if (spmat_f64.rows() == 0)
+                return 0.0;
+            klu_condest(spmat_f64.outerIndexPtr(), reinterpret_cast<double*>(spmat_f64.valuePtr()), Symbolic, Numeric, &Common);
+            break;
+        default:
+            if (spmat.rows() == 0)
+                return 0.0;
+            klu_z_condest(spmat.outerIndexPtr(), reinterpret_cast<double*>(spmat.valuePtr()), Symbolic, Numeric, &Common);
+            break;
+    }
+    return Common.condest;
+}
+
+double KLUSystemX::GetFlops()
+{
+    if (UsesSparseLU())
+        return -1; // not available with Eigen's SparseLU
+
+    if (UsesBlockFactorization())
+    {
+        double flops = 0;
+        for (auto &b: factorBlocks)
+        {
+            if (!b.Numeric)
+                continue;
+            if (dataFormat == MatrixFormat_DoublePrecisionReal)
+                klu_flops(b.Symbolic, b.Numeric, &Common);
+            else
+                klu_z_flops(b.Symbolic, b.Numeric, &Common);
+            flops += Common.flops;
+        }
+        return flops;
+    }
+
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            klu_flops(Symbolic, Numeric, &Common);
+            break;
+        default:
+            klu_z_flops(Symbolic, Numeric, &Common);
+            break;
+    }    
+    return Common.flops;
+}
+
+int KLUSystemX::FindDisconnectedSubnetwork()
+{
+    Factor();
+
+    return m_fltBus;
+}
+
+// stack-based DFS from Sedgewick
+static void mark_dfs(std::vector<int> &stack, unsigned int j, unsigned int cnt, const int* Ap, const int* Ai, int* clique)
+{
+    int i, k;
+    stack.push_back(j);
+    while (!stack.empty())
+    {
+        j = stack.back();
+        stack.pop_back();
+        clique[j] = cnt;
+        for (k = Ap[j]; k < Ap[j + 1]; k++)
+        {
+            i = Ai[k];
+            if (clique[i] == 0)
+            {
+                stack.push_back(i);
+                clique[i] = (unsigned int) -1; // to only push once
+            }
+        }
+    }
+}
+
+// The KLU factorization might have some information about cliques in Y22 only,
+//   but we want to consider the whole system, so this function
+//   performs a new DFS on the compressed non-zero pattern
+// This function could behave differently than before,
+//   since the compression process removes numerical zero elements
+int KLUSystemX::FindIslands(unsigned int* idClique)
+{
+    Factor();
+
+    const int* Ap;
+    const int* Ai;
+    int j;
+
+    if (UsesBlockFactorization() && !factorBlocks.empty())
+    {
+        // the blocks are already the connected components, numbered by their lowest node like below
+        for (size_t k = 0; k < factorBlocks.size(); ++k)
+        {
+            for (uint32_t i: factorBlocks[k].nodes)
+                idClique[i] = k + 1;
+        }
+        return factorBlocks.size();
+    }
+
+    if (!GetPattern(Ap, Ai))
+        return 0;
+
+    int* clique = new int[m_nBus];
+
+    // DFS down the columns
+    int cnt = 0;
+    for (j = 0; j < m_nBus; j++)
+        clique[j] = cnt; // use to mark the nodes with clique #
+    
+    std::vector<int> stack;
+    stack.reserve(m_nBus + 1);
+    for (j = 0; j < m_nBus; j++)
+    {
+        if (clique[j] == 0)
+        { // have not visited this column yet
+            ++cnt;
+            mark_dfs(stack, j, cnt, Ap, Ai, clique);
+        }
+    }
+
+    for (j = 0; j < m_nBus; j++)
+        idClique[j] = clique[j];
+
+    delete[] clique;
+
+    return cnt;
+}
+
+void KLUSystemX::zero()
+{
+    if ((flags & Option_ReuseAssemblyMap) && asmState == AsmMap_Ready)
+    {
+        // keep the CSC pattern and the factorization, only zero the values
+        switch (dataFormat)
+        {
+            case MatrixFormat_DoublePrecisionReal:
+                spmat_f64.coeffs().setZero();
+                break;
+            case MatrixFormat_SinglePrecisionComplex:
+                spmat_c64.coeffs().setZero();
+                break;
+            case MatrixFormat_SinglePrecisionReal:
+                spmat_f32.coeffs().setZero();
+                break;
+            default:
+                spmat.coeffs().setZero();
+                break;
+        }
+        asmNodesPos = asmSlotsPos = 0;
+        asmState = AsmMap_Replaying;
+        ClearPrimitives(true);
+        ++matrixVersion;
+        return;
+    }
+    Initialize(m_nBus, 0, m_nBus);
+}
+
+void KLUSystemX::AddElement(unsigned int iRow, unsigned int iCol, complex& cpxVal, int)
+{
+    if (iRow > m_nBus || iCol > m_nBus)
+        return;
+    if (iRow <= 0 || iCol <= 0)
+        return;
+    if (cpxVal.real() == 0.0 && cpxVal.imag() == 0.0)
+        return;
+
+    // single elements are not tracked in the assembly map
+    if (asmState == AsmMap_Replaying)
+        AbandonAssemblyMap();
+    else if (asmState == AsmMap_Ready)
+        ClearAssemblyMap();
+    ++matrixVersion;
+
+    // an existing entry keeps the pattern, and the slots with it; a new one is
+    // inserted and the matrix compressed again before its next use
+    const int32_t idx = FindValueIndex(iRow - 1, iCol - 1);
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            if (idx >= 0)
+            {
+                spmat_f64.valuePtr()[idx] += cpxVal.real();
+                return;
+            }
+            if (spmat_f64.nonZeros())
+            {
+                spmat_f64.coeffRef(iRow - 1, iCol - 1) += cpxVal.real();
+                ++patternVersion;
+                return;
+            }
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+            if (idx >= 0)
+            {
+                spmat_c64.valuePtr()[idx] += std::complex<float>(cpxVal);
+                return;
+            }
+            if (spmat_c64.nonZeros())
+            {
+                spmat_c64.coeffRef(iRow - 1, iCol - 1) += std::complex<float>(cpxVal);
+                ++patternVersion;
+                return;
+            }
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            if (idx >= 0)
+            {
+                spmat_f32.valuePtr()[idx] += float(cpxVal.real());
+                return;
+            }
+            if (spmat_f32.nonZeros())
+            {
+                spmat_f32.coeffRef(iRow - 1, iCol - 1) += float(cpxVal.real());
+                ++patternVersion;
+                return;
+            }
+            break;
+        default:
+            if (idx >= 0)
+            {
+                spmat.valuePtr()[idx] += cpxVal;
+                return;
+            }
+            if (spmat.nonZeros())
+            {
+                spmat.coeffRef(iRow - 1, iCol - 1) += cpxVal;
+                ++patternVersion;
+                return;
+            }
+            break;
+    }
+    triplets.push_back({ static_cast<int>(iRow) - 1, static_cast<int>(iCol) - 1, cpxVal });
+}
+
+void KLUSystemX::GetElement(unsigned int iRow, unsigned int iCol, complex& cpxVal)
+{
+    cpxVal = complex(0.0);
+
+    if (iRow > m_nBus || iCol > m_nBus)
+        return;
+    if (iRow == 0 || iCol == 0)
+        return;
+
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            cpxVal = spmat_f64.coeff(iRow - 1, iCol - 1);
+            return;
+        case MatrixFormat_SinglePrecisionComplex:
+            cpxVal = complex(spmat_c64.coeff(iRow - 1, iCol - 1));
+            return;
+        case MatrixFormat_SinglePrecisionReal:
+            cpxVal = spmat_f32.coeff(iRow - 1, iCol - 1);
+            return;
+        default:
+            cpxVal = spmat.coeff(iRow - 1, iCol - 1);
+            return;
+    }
+}
+
+int KLUSystemX::IncrementElement(unsigned int iRow, unsigned int iCol, double re, double im)
+{
+    if ((options < ReuseCompressedMatrix) || (iRow > m_nBus || iCol > m_nBus) || (iRow == 0 || iCol == 0))
+        return 0;
+
+    const int32_t idx = FindValueIndex(iRow - 1, iCol - 1);
+    if (idx < 0)
+        return 0; // no row
+
+    ++matrixVersion;
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            spmat_f64.valuePtr()[idx] += re;
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+            spmat_c64.valuePtr()[idx] += std::complex<float>(re, im);
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            spmat_f32.valuePtr()[idx] += re;
+            break;
+        default:
+            spmat.valuePtr()[idx] += complex(re, im);
+            break;
+    }
+    return 1;
+}
+
+int KLUSystemX::ZeroiseElement(unsigned int iRow, unsigned int iCol)
+{
+    if ((options < ReuseCompressedMatrix) || (iRow > m_nBus || iCol > m_nBus) || (iRow == 0 || iCol == 0))
+        return 0;
+
+    const int32_t idx = FindValueIndex(iRow - 1, iCol - 1);
+    if (idx < 0)
+        return 0; // no row
+
+    ++matrixVersion;
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            spmat_f64.valuePtr()[idx] = 0;
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+            spmat_c64.valuePtr()[idx] = 0;
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            spmat_f32.valuePtr()[idx] = 0;
+            break;
+        default:
+            spmat.valuePtr()[idx] = 0;
+            break;
+    }
+    return 1;
+}
+
+int KLUSystemX::GetElementSlots(unsigned int nElements, const unsigned int* pRows, const unsigned int* pCols, int32_t* pSlots, uint64_t& version)
+{
+    if (triplets.size())
+        ProcessTriplets();
+    CompressMatrix();
+    version = patternVersion;
+
+    int rc = 1;
+    for (unsigned int k = 0; k < nElements; k++)
+    {
+        const unsigned int iRow = pRows[k], iCol = pCols[k];
+        if (iRow > m_nBus || iCol > m_nBus || iRow == 0 || iCol == 0)
+            pSlots[k] = -1;
+        else
+            pSlots[k] = FindValueIndex(iRow - 1, iCol - 1);
+
+        if (pSlots[k] < 0)
+            rc = 0;
+    }
+    return rc;
+}
+
+int KLUSystemX::IncrementElements(unsigned int nElements, const int32_t* pSlots, const complex* pValues, uint64_t version)
+{
+    if (options < ReuseCompressedMatrix || !pValues || version != patternVersion)
+        return 0;
+
+    int rc;
     switch (dataFormat)
     {
         case MatrixFormat_DoublePrecisionReal:
-            klu_rcond(Symbolic, Numeric, &Common);
+            rc = UpdateSlots(spmat_f64, nElements, pSlots, pValues);
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+            rc = UpdateSlots(spmat_c64, nElements, pSlots, pValues);
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            rc = UpdateSlots(spmat_f32, nElements, pSlots, pValues);
             break;
         default:
-            klu_z_rcond(Symbolic, Numeric, &Common);
+            rc = UpdateSlots(spmat, nElements, pSlots, pValues);
             break;
     }
-    return Common.rcond;
+    if (rc)
+        ++matrixVersion;
+    return rc;
 }
 
-double KLUSystemX::GetRGrowth()
+int KLUSystemX::AddLowRankUpdate(unsigned int nElements, const unsigned int* pRows, const unsigned int* pCols, const complex* pValues)
 {
+    if (!bFactored || !HasFactorization() || UsesSparseLU() || UsesBlockFactorization() || IsRefinementRequired())
+        return 0;
+
+    RefreshLowRankSlots();
+
+    // resolve all entries first, nothing is changed if any is missing
+    std::vector<int32_t> slots(nElements);
+    for (unsigned int k = 0; k < nElements; k++)
+    {
+        if (pRows[k] < 1 || pCols[k] < 1 || pRows[k] > m_nX || pCols[k] > m_nX)
+            return 0;
+
+        slots[k] = FindValueIndex(pRows[k] - 1, pCols[k] - 1);
+        if (slots[k] < 0)
+            return 0;
+    }
+
+    // the matrix values are kept up-to-date for the next factorization
+    ++matrixVersion;
     switch (dataFormat)
     {
         case MatrixFormat_DoublePrecisionReal:
-            if (spmat_f64.rows() == 0)
-                return 0.0;
-            if (klu_rgrowth(spmat_f64.outerIndexPtr(), spmat_f64.innerIndexPtr(), reinterpret_cast<double*>(spmat_f64.valuePtr()), Symbolic, Numeric, &Common) == 1)
-                return Common.rgrowth;
+            UpdateSlots(spmat_f64, nElements, slots.data(), pValues);
             break;
         default:
-            if (spmat.rows() == 0)
-                return 0.0;
-            if (klu_z_rgrowth(spmat.outerIndexPtr(), spmat.innerIndexPtr(), reinterpret_cast<double*>(spmat.valuePtr()), Symbolic, Numeric, &Common) == 1)
-                return Common.rgrowth;
+            UpdateSlots(spmat, nElements, slots.data(), pValues);
             break;
     }
-    return -1;
+
+    std::vector<uint32_t> touchedCols;
+    touchedCols.reserve(nElements);
+    for (unsigned int k = 0; k < nElements; k++)
+    {
+        lrEntries.push_back({ slots[k], pRows[k] - 1, pCols[k] - 1, pValues[k] });
+        touchedCols.push_back(pCols[k] - 1);
+    }
+    std::sort(touchedCols.begin(), touchedCols.end());
+    touchedCols.erase(std::unique(touchedCols.begin(), touchedCols.end()), touchedCols.end());
+
+    const std::vector<uint32_t>& currentCols = (dataFormat == MatrixFormat_DoublePrecisionReal) ? lrReal.cols : lrComplex.cols;
+    size_t rank = currentCols.size();
+    for (uint32_t col: touchedCols)
+    {
+        if (std::find(currentCols.begin(), currentCols.end(), col) == currentCols.end())
+            ++rank;
+    }
+    if (rank > maxLowRank)
+    {
+        // the dense correction would cost more than refactoring
+        ClearLowRankUpdates(false);
+        bFactored = false;
+        samePattern = true;
+        return 2;
+    }
+
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            UpdateLowRankCorrection(lrReal, touchedCols);
+            break;
+        default:
+            UpdateLowRankCorrection(lrComplex, touchedCols);
+            break;
+    }
+    // the factorization with the correction still matches the matrix
+    factorMatrixVersion = matrixVersion;
+    return 1;
 }
 
-double KLUSystemX::GetCondEst()
+template <typename Scalar>
+void KLUSystemX::UpdateLowRankCorrection(LowRankCorrection<Scalar>& lr, const std::vector<uint32_t>& touchedCols)
+{
+    typedef typename LowRankCorrection<Scalar>::DenseMatrix DenseMatrix;
+
+    // only the columns of W for the touched columns of U change
+    std::vector<Eigen::Index> touchedIdx;
+    touchedIdx.reserve(touchedCols.size());
+    for (uint32_t col: touchedCols)
+    {
+        auto it = std::find(lr.cols.begin(), lr.cols.end(), col);
+        touchedIdx.push_back(it - lr.cols.begin());
+        if (it == lr.cols.end())
+            lr.cols.push_back(col);
+    }
+    const Eigen::Index nCols = lr.cols.size();
+    lr.W.conservativeResize(m_nX, nCols);
+
+    DenseMatrix U = DenseMatrix::Zero(m_nX, touchedCols.size());
+    for (auto &e: lrEntries)
+    {
+        auto it = std::lower_bound(touchedCols.begin(), touchedCols.end(), e.col);
+        if (it != touchedCols.end() && *it == e.col)
+            U(e.row, it - touchedCols.begin()) += FormatValue<Scalar>::From(e.delta);
+    }
+    KLUSolveBlock(Symbolic, Numeric, m_nX, U.cols(), U.data(), &Common);
+    for (size_t k = 0; k < touchedIdx.size(); ++k)
+        lr.W.col(touchedIdx[k]) = U.col(k);
+
+    DenseMatrix K = DenseMatrix::Identity(nCols, nCols);
+    for (Eigen::Index i = 0; i < nCols; ++i)
+        K.row(i) += lr.W.row(lr.cols[i]);
+    lr.K.compute(K);
+}
+
+// AddElement may have inserted entries since the slots were resolved
+void KLUSystemX::RefreshLowRankSlots()
+{
+    CompressMatrix();
+    if (lrPatternVersion == patternVersion)
+        return;
+
+    for (auto &e: lrEntries)
+        e.slot = FindValueIndex(e.row, e.col);
+    lrPatternVersion = patternVersion;
+}
+
+void KLUSystemX::ClearLowRankUpdates(bool revert)
+{
+    if (revert && !lrEntries.empty())
+    {
+        RefreshLowRankSlots();
+        std::vector<int32_t> slots;
+        std::vector<complex> values;
+        slots.reserve(lrEntries.size());
+        values.reserve(lrEntries.size());
+        for (auto &e: lrEntries)
+        {
+            slots.push_back(e.slot);
+            values.push_back(-e.delta);
+        }
+        ++matrixVersion;
+        switch (dataFormat)
+        {
+            case MatrixFormat_DoublePrecisionReal:
+                UpdateSlots(spmat_f64, slots.size(), slots.data(), values.data());
+                break;
+            default:
+                UpdateSlots(spmat, slots.size(), slots.data(), values.data());
+                break;
+        }
+    }
+    lrEntries.clear();
+    lrComplex.Clear();
+    lrReal.Clear();
+}
+
+void KLUSystemX::ApplyLowRankCorrection(void* pX, unsigned int nRHS, unsigned int ldim) const
 {
     switch (dataFormat)
     {
         case MatrixFormat_DoublePrecisionReal:
-            if (spmat_f64.rows() == 0)
-                return 0.0;
-            klu_condest(spmat_f64.outerIndexPtr(), reinterpret_cast<double*>(spmat_f64.valuePtr()), Symbolic, Numeric, &Common);
+            lrReal.Apply(static_cast<double*>(pX), nRHS, ldim);
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+        case MatrixFormat_SinglePrecisionReal:
             break;
         default:
-            if (spmat.rows() == 0)
-                return 0.0;
-            klu_z_condest(spmat.outerIndexPtr(), reinterpret_cast<double*>(spmat.valuePtr()), Symbolic, Numeric, &Common);
+            lrComplex.Apply(static_cast<complex*>(pX), nRHS, ldim);
             break;
     }
-    return Common.condest;
 }
 
-double KLUSystemX::GetFlops()
+int KLUSystemX::ZeroiseElements(unsigned int nElements, const int32_t* pSlots, uint64_t version)
 {
+    if (options < ReuseCompressedMatrix || version != patternVersion)
+        return 0;
+
+    int rc;
     switch (dataFormat)
     {
         case MatrixFormat_DoublePrecisionReal:
-            klu_flops(Symbolic, Numeric, &Common);
+            rc = UpdateSlots(spmat_f64, nElements, pSlots, nullptr);
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+            rc = UpdateSlots(spmat_c64, nElements, pSlots, nullptr);
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            rc = UpdateSlots(spmat_f32, nElements, pSlots, nullptr);
             break;
         default:
-            klu_z_flops(Symbolic, Numeric, &Common);
+            rc = UpdateSlots(spmat, nElements, pSlots, nullptr);
             break;
-    }    
-    return Common.flops;
+    }
+    if (rc)
+        ++matrixVersion;
+    return rc;
 }
 
-int KLUSystemX::FindDisconnectedSubnetwork()
+int KLUSystemX::GetCompressedMatrix(unsigned int nColP, unsigned int nNZ, unsigned int* pColP, unsigned int* pRowIdx, complex* pMat)
 {
-    Factor();
+    if (triplets.size())
+        ProcessTriplets();
+    CompressMatrix();
 
-    return m_fltBus;
+    // the values are copied in the element type of the matrix format
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            return CopyCompressed(spmat_f64, nColP, nNZ, pColP, pRowIdx, pMat);
+        case MatrixFormat_SinglePrecisionComplex:
+            return CopyCompressed(spmat_c64, nColP, nNZ, pColP, pRowIdx, pMat);
+        case MatrixFormat_SinglePrecisionReal:
+            return CopyCompressed(spmat_f32, nColP, nNZ, pColP, pRowIdx, pMat);
+        default:
+            return CopyCompressed(spmat, nColP, nNZ, pColP, pRowIdx, pMat);
+    }
 }
 
-// stack-based DFS from Sedgewick
-static void mark_dfs(std::vector<int> &stack, unsigned int j, unsigned int cnt, int* Ap, int* Ai, int* clique)
+int KLUSystemX::GetMatrixView(KLUSolveXMatrixView* pView)
 {
-    int i, k;
-    stack.push_back(j);
-    while (!stack.empty())
+    if (triplets.size())
+        ProcessTriplets();
+    CompressMatrix();
+
+    // the arrays of the matrix itself, in the element type of the matrix format
+    bool valid;
+    switch (dataFormat)
     {
-        j = stack.back();
-        stack.pop_back();
-        clique[j] = cnt;
-        for (k = Ap[j]; k < Ap[j + 1]; k++)
+        case MatrixFormat_DoublePrecisionReal:
+            valid = ViewCompressed(spmat_f64, m_nX, pView);
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+            valid = ViewCompressed(spmat_c64, m_nX, pView);
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            valid = ViewCompressed(spmat_f32, m_nX, pView);
+            break;
+        default:
+            valid = ViewCompressed(spmat, m_nX, pView);
+            break;
+    }
+    if (!valid)
+        return 0;
+
+    pView->version = matrixVersion;
+    pView->n = m_nX;
+    pView->dataFormat = dataFormat;
+    return 1;
+}
+
+int KLUSystemX::GetTripletMatrix(unsigned int nNZ, unsigned int* pRows, unsigned int* pCols, complex* pMat)
+{
+    if (triplets.size())
+        ProcessTriplets();
+    CompressMatrix();
+
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            return CopyTriplets(spmat_f64, nNZ, pRows, pCols, pMat);
+        case MatrixFormat_SinglePrecisionComplex:
+            return CopyTriplets(spmat_c64, nNZ, pRows, pCols, pMat);
+        case MatrixFormat_SinglePrecisionReal:
+            return CopyTriplets(spmat_f32, nNZ, pRows, pCols, pMat);
+        default:
+            return CopyTriplets(spmat, nNZ, pRows, pCols, pMat);
+    }
+}
+
+int KLUSystemX::SaveAsMarketFiles(const char* fileNameMatrix, const double *b, const char* fileNameVector)
+{
+    bool res = 0;
+    if (triplets.size())
+        ProcessTriplets();
+
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:  
+            res = Eigen::saveMarket(spmat_f64, fileNameMatrix);
+            if (!res)
+            {
+                return 0;
+            }
+            if (b)
+            {
+                Eigen::VectorXd Bcopy = Eigen::Map<const Eigen::VectorXd>(b, spmat_f64.rows());
+                res = Eigen::saveMarketVector(Bcopy, fileNameVector);
+            }
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+            res = Eigen::saveMarket(spmat_c64, fileNameMatrix);
+            if (!res)
+            {
+                return 0;
+            }
+            if (b)
+            {
+                Eigen::VectorXcf Bcopy = Eigen::Map<const Eigen::VectorXcf>(reinterpret_cast<const std::complex<float>*>(b), spmat_c64.rows());
+                res = Eigen::saveMarketVector(Bcopy, fileNameVector);
+            }
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            res = Eigen::saveMarket(spmat_f32, fileNameMatrix);
+            if (!res)
+            {
+                return 0;
+            }
+            if (b)
+            {
+                Eigen::VectorXf Bcopy = Eigen::Map<const Eigen::VectorXf>(reinterpret_cast<const float*>(b), spmat_f32.rows());
+                res = Eigen::saveMarketVector(Bcopy, fileNameVector);
+            }
+            break;
+        default:
         {
-            i = Ai[k];
-            if (clique[i] == 0)
+            res = Eigen::saveMarket(spmat, fileNameMatrix);
+            if (!res)
             {
-                stack.push_back(i);
-                clique[i] = (unsigned int) -1; // to only push once
+                return 0;
+            }
+            if (b)
+            {
+                res = Eigen::saveMarketVector(Eigen::Map<const Eigen::VectorXcd>(reinterpret_cast<const complex*>(b), spmat.rows()), fileNameVector);
             }
+            break;
+        }
+    }
+    if (!res)
+    {
+        return 0;
+    }
+    return 1;
+}
+
+// SaveSymbolic file layout, in native byte order: this header, then P and Q
+// (n entries each) and R (nblocks + 1 entries), as int32
+struct SymbolicFileHeader
+{
+    char magic[8];
+    uint32_t n;
+    int32_t nblocks;
+    uint64_t nnz;
+    uint64_t patternHash;
+};
+static const char SymbolicFileMagic[8] = { 'K', 'L', 'U', 'X', 'S', 'Y', 'M', '1' };
+
+int KLUSystemX::SaveSymbolic(const char* path)
+{
+    if (!path || UsesSparseLU() || UsesBlockFactorization() || !Symbolic)
+        return 0;
+
+    const int* Ap;
+    const int* Ai;
+    if (!GetPattern(Ap, Ai) || uint32_t(Symbolic->n) != m_nX)
+        return 0;
+
+    SymbolicFileHeader header;
+    memcpy(header.magic, SymbolicFileMagic, sizeof(header.magic));
+    header.n = m_nX;
+    header.nblocks = Symbolic->nblocks;
+    header.nnz = Ap[m_nX];
+    header.patternHash = GetPatternHash();
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+        return 0;
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(Symbolic->P), sizeof(int32_t) * m_nX);
+    out.write(reinterpret_cast<const char*>(Symbolic->Q), sizeof(int32_t) * m_nX);
+    out.write(reinterpret_cast<const char*>(Symbolic->R), sizeof(int32_t) * (Symbolic->nblocks + 1));
+    return out.good() ? 1 : 0;
+}
+
+int KLUSystemX::LoadSymbolic(const char* path)
+{
+    if (!path)
+        return 0;
+
+    std::ifstream in(path, std::ios::binary);
+    SymbolicFileHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+        return 0;
+    if (memcmp(header.magic, SymbolicFileMagic, sizeof(header.magic)) || header.n != m_nX || header.nblocks < 1 || uint32_t(header.nblocks) > m_nX)
+        return 0;
+
+    GivenOrdering ordering;
+    ordering.n = header.n;
+    ordering.patternHash = header.patternHash;
+    ordering.P.resize(header.n);
+    ordering.Q.resize(header.n);
+    ordering.R.resize(header.nblocks + 1);
+    in.read(reinterpret_cast<char*>(ordering.P.data()), sizeof(int32_t) * header.n);
+    in.read(reinterpret_cast<char*>(ordering.Q.data()), sizeof(int32_t) * header.n);
+    in.read(reinterpret_cast<char*>(ordering.R.data()), sizeof(int32_t) * ordering.R.size());
+    if (!in)
+        return 0;
+    if (ordering.R[0] != 0 || uint32_t(ordering.R[header.nblocks]) != header.n)
+        return 0;
+    for (int32_t b = 0; b < header.nblocks; ++b)
+    {
+        if (ordering.R[b + 1] <= ordering.R[b])
+            return 0;
+    }
+
+    // KLU trusts the permutations it is given
+    std::vector<char> seenP(header.n, 0), seenQ(header.n, 0);
+    for (uint32_t k = 0; k < header.n; ++k)
+    {
+        const uint32_t i = ordering.P[k], j = ordering.Q[k];
+        if (i >= header.n || j >= header.n || seenP[i] || seenQ[j])
+            return 0;
+        seenP[i] = seenQ[j] = 1;
+    }
+
+    givenOrdering = std::move(ordering);
+    return 1;
+}
+
+/*
+KLU user_order callback for Ordering_METIS: nested dissection of the graph of
+A+A' for one block. Perm[k] is the column of the block eliminated k-th.
+Returns a lower bound of nnz(L), which KLU uses for its initial allocation,
+or 0 on failure.
+*/
+static int MetisOrdering(int n, int* Ap, int* Ai, int* Perm, klu_common*)
+{
+    // adjacency lists without the diagonal or duplicates
+    std::vector<std::vector<idx_t> > adjacent(n);
+    for (int j = 0; j < n; ++j)
+    {
+        for (int p = Ap[j]; p < Ap[j + 1]; ++p)
+        {
+            const int i = Ai[p];
+            if (i == j)
+                continue;
+
+            adjacent[i].push_back(j);
+            adjacent[j].push_back(i);
         }
     }
+    std::vector<idx_t> xadj(n + 1), adjncy;
+    adjncy.reserve(2 * size_t(Ap[n]));
+    xadj[0] = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        std::vector<idx_t>& a = adjacent[i];
+        std::sort(a.begin(), a.end());
+        a.erase(std::unique(a.begin(), a.end()), a.end());
+        adjncy.insert(adjncy.end(), a.begin(), a.end());
+        xadj[i + 1] = adjncy.size();
+    }
+
+    std::vector<idx_t> perm(n), iperm(n);
+    if (adjncy.empty())
+    {
+        std::iota(perm.begin(), perm.end(), 0);
+    }
+    else
+    {
+        idx_t nvtxs = n;
+        if (METIS_NodeND(&nvtxs, xadj.data(), adjncy.data(), nullptr, nullptr, perm.data(), iperm.data()) != METIS_OK)
+            return 0;
+    }
+    std::copy(perm.begin(), perm.end(), Perm);
+    return n + int(adjncy.size() / 2);
 }
 
-// The KLU factorization might have some information about cliques in Y22 only,
-//   but we want to consider the whole system, so this function
-//   performs a new DFS on the compressed non-zero pattern
-// This function could behave differently than before,
-//   since the compression process removes numerical zero elements
-int KLUSystemX::FindIslands(unsigned int* idClique)
+void KLUSystemX::ApplyOrdering()
 {
-    Factor();
-
-    int* clique = new int[m_nBus];
-    int* Ap;
-    int* Ai;
-    int j;
-
-    switch (dataFormat)
+    switch (orderingMethod)
     {
-        case MatrixFormat_DoublePrecisionReal:
-            Ap = spmat_f64.outerIndexPtr();
-            Ai = spmat_f64.innerIndexPtr();
+        case Ordering_COLAMD:
+            Common.ordering = 1;
+            Common.user_order = nullptr;
+            break;
+        case Ordering_METIS:
+            Common.ordering = 3;
+            Common.user_order = MetisOrdering;
             break;
         default:
-            Ap = spmat.outerIndexPtr();
-            Ai = spmat.innerIndexPtr();
+            // Ordering_Given uses klu_analyze_given, AMD still orders when it doesn't apply
+            Common.ordering = 0;
+            Common.user_order = nullptr;
             break;
     }
+}
 
-    // DFS down the columns
-    int cnt = 0;
-    for (j = 0; j < m_nBus; j++)
-        clique[j] = cnt; // use to mark the nodes with clique #
-    
-    std::vector<int> stack;
-    stack.reserve(m_nBus + 1);
-    for (j = 0; j < m_nBus; j++)
+int KLUSystemX::SetOrdering(unsigned int method, unsigned int n, const int32_t* pPerm)
+{
+    std::vector<int> perm, rank;
+    switch (method)
     {
-        if (clique[j] == 0)
-        { // have not visited this column yet
-            ++cnt;
-            mark_dfs(stack, j, cnt, Ap, Ai, clique);
-        }
+        case Ordering_AMD:
+        case Ordering_COLAMD:
+        case Ordering_METIS:
+            break;
+        case Ordering_Given:
+            if (n != m_nX || (n && !pPerm))
+                return 0;
+
+            // KLU trusts the permutations it is given
+            perm.assign(pPerm, pPerm + n);
+            rank.assign(n, -1);
+            for (uint32_t k = 0; k < n; ++k)
+            {
+                if (perm[k] < 0 || uint32_t(perm[k]) >= n || rank[perm[k]] != -1)
+                    return 0;
+
+                rank[perm[k]] = k;
+            }
+            break;
+        default:
+            return 0;
     }
 
-    for (j = 0; j < m_nBus; j++)
-        idClique[j] = clique[j];
+    orderingMethod = method;
+    orderingPerm.swap(perm);
+    orderingRank.swap(rank);
+    ApplyOrdering();
 
-    delete[] clique;
+    // analyze again with the new ordering on the next factorization
+    KLUMemoryScope memoryScope(kluPool.get());
+    ClearLowRankUpdates(false);
+    ClearFactorBlocks();
+    if (Numeric)
+        klu_free_numeric(&Numeric, &Common);
+    if (Symbolic)
+        klu_free_symbolic(&Symbolic, &Common);
+    bFactored = false;
+    staleFactorization = false;
+    if (triplets.empty())
+        samePattern = true;
 
-    return cnt;
+    return 1;
 }
 
-void KLUSystemX::zero()
+// Read-only mapping of a whole file, data() is null if it couldn't be mapped
+class MappedFile
 {
-    Initialize(m_nBus, 0, m_nBus);
-}
+public:
+    explicit MappedFile(const char* path);
+    ~MappedFile();
+    const char* data() const { return ptr; }
+    size_t size() const { return len; }
 
-void KLUSystemX::AddElement(unsigned int iRow, unsigned int iCol, complex& cpxVal, int)
+private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* ptr;
+    size_t len;
+#ifdef _WIN32
+    HANDLE file, mapping;
+#else
+    int fd;
+#endif
+};
+
+#ifdef _WIN32
+MappedFile::MappedFile(const char* path)
+    : ptr(nullptr)
+    , len(0)
+    , mapping(NULL)
 {
-    if (iRow > m_nBus || iCol > m_nBus)
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
         return;
-    if (iRow <= 0 || iCol <= 0)
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart <= 0)
         return;
-    if (cpxVal.real() == 0.0 && cpxVal.imag() == 0.0)
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping)
         return;
 
-    switch (dataFormat)
-    {
-        case MatrixFormat_DoublePrecisionReal:
-            if (spmat_f64.nonZeros())
-            {
-                spmat_f64.coeffRef(iRow - 1, iCol - 1) += cpxVal.real();
-                return;
-            }
-            break;
-        default:
-            if (spmat.nonZeros())
-            {
-                spmat.coeffRef(iRow - 1, iCol - 1) += cpxVal;
-                return;
-            }
-            break;
-    }
-    triplets.push_back({ static_cast<int>(iRow) - 1, static_cast<int>(iCol) - 1, cpxVal });
+    ptr = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (ptr)
+        len = size_t(fileSize.QuadPart);
 }
 
-void KLUSystemX::GetElement(unsigned int iRow, unsigned int iCol, complex& cpxVal)
+MappedFile::~MappedFile()
 {
-    cpxVal = complex(0.0);
+    if (ptr)
+        UnmapViewOfFile(ptr);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+}
+#else
+MappedFile::MappedFile(const char* path)
+    : ptr(nullptr)
+    , len(0)
+{
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return;
 
-    if (iRow > m_nBus || iCol > m_nBus)
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
         return;
-    if (iRow == 0 || iCol == 0)
+
+    void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
         return;
 
-    switch (dataFormat)
+    ptr = static_cast<const char*>(p);
+    len = size_t(st.st_size);
+}
+
+MappedFile::~MappedFile()
+{
+    if (ptr)
+        munmap(const_cast<char*>(ptr), len);
+    if (fd >= 0)
+        close(fd);
+}
+#endif
+
+// Snapshot file layout, in native byte order: this header, then the nnz matrix
+// values, the right-hand side and the solution if present (n values each), all
+// in the element type of the format, then Ap (n + 1 entries) and Ai (nnz
+// entries) as int32. With the values first, every array is naturally aligned.
+struct SnapshotFileHeader
+{
+    char magic[8];
+    uint32_t n;
+    uint32_t entrySize;
+    uint64_t nnz;
+    uint64_t opts; // SetOptions value
+    uint64_t contents; // SnapshotContents
+};
+static const char SnapshotFileMagic[8] = { 'K', 'L', 'U', 'X', 'S', 'N', 'P', '1' };
+enum SnapshotContents
+{
+    Snapshot_RHS = 1,
+    Snapshot_Solution = 2
+};
+
+// size in bytes of each value for the format in SetOptions value, 0 if invalid
+static size_t SnapshotEntrySize(uint64_t opts)
+{
+    switch (opts & 0x00F0)
     {
+        case 0:
+            return sizeof(complex);
         case MatrixFormat_DoublePrecisionReal:
-            cpxVal = spmat_f64.coeff(iRow - 1, iCol - 1);
-            return;
+            return sizeof(double);
+        case MatrixFormat_SinglePrecisionComplex:
+            return sizeof(std::complex<float>);
+        case MatrixFormat_SinglePrecisionReal:
+            return sizeof(float);
         default:
-            cpxVal = spmat.coeff(iRow - 1, iCol - 1);
-            return;
+            return 0;
     }
 }
 
-int KLUSystemX::IncrementElement(unsigned int iRow, unsigned int iCol, double re, double im)
+// checks the header and the size of a mapped snapshot, returns the offset of the vectors
+static bool CheckSnapshot(const MappedFile& file, SnapshotFileHeader& header, size_t& vectorsOffset)
 {
-    if ((options < ReuseCompressedMatrix) || (iRow > m_nBus || iCol > m_nBus) || (iRow == 0 || iCol == 0))
-        return 0;
+    if (!file.data() || file.size() < sizeof(header))
+        return false;
 
-    --iRow;
-    --iCol;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, SnapshotFileMagic, sizeof(header.magic)) != 0)
+        return false;
 
-    switch (dataFormat)
-    {
-        case MatrixFormat_DoublePrecisionReal:
-        {
-            double* colData;
-            int rowIdxInCol;
+    const size_t entrySize = SnapshotEntrySize(header.opts);
+    if (!entrySize || header.entrySize != entrySize || header.nnz > uint64_t(std::numeric_limits<int32_t>::max()))
+        return false;
+
+    const uint64_t nVectors = ((header.contents & Snapshot_RHS) ? 1 : 0) + ((header.contents & Snapshot_Solution) ? 1 : 0);
+    const uint64_t expectedSize = sizeof(header) + (header.nnz + nVectors * header.n) * entrySize + (uint64_t(header.n) + 1 + header.nnz) * sizeof(int32_t);
+    if (file.size() != expectedSize)
+        return false;
 
-            double* Ax = spmat_f64.valuePtr();
-            int* Ap = spmat_f64.outerIndexPtr();
-            int* Ai = spmat_f64.innerIndexPtr();
-            const int numColElements = Ap[iCol + 1] - Ap[iCol];
-            const int* it_begin = (Ai) + Ap[iCol];
-            const int* it_end = (Ai) + Ap[iCol + 1];
+    vectorsOffset = sizeof(header) + header.nnz * entrySize;
+    return true;
+}
 
-            const int* it = std::lower_bound(it_begin, it_end, iRow);
-            if (it == it_end || (*it != iRow))
-                return 0; // no row
+template <typename MatrixT>
+static int WriteSnapshot(const char* path, const MatrixT& stored, const std::vector<Eigen::Triplet<complex> >& triplets, uint64_t opts, const void* b, const void* x)
+{
+    typedef typename MatrixT::Scalar Scalar;
 
-            rowIdxInCol = (it - it_begin);
-            colData = Ax + Ap[iCol];
-            colData[rowIdxInCol] += re;
-        }
-        default:
-        {
-            complex* colData;
-            int rowIdxInCol;
+    // the snapshot is taken without changing the state of the system
+    MatrixT pending;
+    const MatrixT* mat = &stored;
+    if (triplets.size())
+    {
+        std::vector<int32_t> work;
+        AssembleTriplets(pending, stored.cols(), triplets, work, true);
+        mat = &pending;
+    }
+    else if (!stored.isCompressed())
+    {
+        pending = stored;
+        pending.makeCompressed();
+        mat = &pending;
+    }
 
-            complex* Ax = spmat.valuePtr();
-            int* Ap = spmat.outerIndexPtr();
-            int* Ai = spmat.innerIndexPtr();
-            const int numColElements = Ap[iCol + 1] - Ap[iCol];
-            const int* it_begin = (Ai) + Ap[iCol];
-            const int* it_end = (Ai) + Ap[iCol + 1];
+    const uint32_t n = mat->cols();
+    SnapshotFileHeader header;
+    memcpy(header.magic, SnapshotFileMagic, sizeof(header.magic));
+    header.n = n;
+    header.entrySize = sizeof(Scalar);
+    header.nnz = mat->nonZeros();
+    header.opts = opts;
+    header.contents = (b ? Snapshot_RHS : 0) | (x ? Snapshot_Solution : 0);
 
-            const int* it = std::lower_bound(it_begin, it_end, iRow);
-            if (it == it_end || (*it != iRow))
-                return 0; // no row
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+        return 0;
 
-            rowIdxInCol = (it - it_begin);
-            colData = Ax + Ap[iCol];
-            colData[rowIdxInCol] += complex(re, im);
-        }
-    }
-    return 1;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(mat->valuePtr()), sizeof(Scalar) * header.nnz);
+    if (b)
+        out.write(static_cast<const char*>(b), sizeof(Scalar) * n);
+    if (x)
+        out.write(static_cast<const char*>(x), sizeof(Scalar) * n);
+    out.write(reinterpret_cast<const char*>(mat->outerIndexPtr()), sizeof(int32_t) * (size_t(n) + 1));
+    out.write(reinterpret_cast<const char*>(mat->innerIndexPtr()), sizeof(int32_t) * header.nnz);
+    return out.good() ? 1 : 0;
 }
 
-int KLUSystemX::ZeroiseElement(unsigned int iRow, unsigned int iCol)
+template <typename MatrixT>
+static void AssignCompressed(MatrixT& mat, uint32_t n, uint64_t nnz, const int32_t* Ap, const int32_t* Ai, const char* Ax)
 {
-    if ((options < ReuseCompressedMatrix) || (iRow > m_nBus || iCol > m_nBus) || (iRow == 0 || iCol == 0))
-        return 0;
+    typedef typename MatrixT::Scalar Scalar;
+    mat.resize(n, n);
+    mat.resizeNonZeros(nnz);
+    memcpy(mat.outerIndexPtr(), Ap, sizeof(int32_t) * (size_t(n) + 1));
+    memcpy(mat.innerIndexPtr(), Ai, sizeof(int32_t) * nnz);
+    memcpy(mat.valuePtr(), Ax, sizeof(Scalar) * nnz);
+}
 
-    --iRow;
-    --iCol;
+int KLUSystemX::SaveSnapshot(const char* path, const double* b, const double* x)
+{
+    if (!path)
+        return 0;
 
+    const uint64_t opts = options | dataFormat | flags;
     switch (dataFormat)
     {
         case MatrixFormat_DoublePrecisionReal:
-        {
-            double* colData;
-            int rowIdxInCol;
-
-            double* Ax = spmat_f64.valuePtr();
-            int* Ap = spmat_f64.outerIndexPtr();
-            int* Ai = spmat_f64.innerIndexPtr();
-            const int numColElements = Ap[iCol + 1] - Ap[iCol];
-            const int* it_begin = (Ai) + Ap[iCol];
-            const int* it_end = (Ai) + Ap[iCol + 1];
-
-            const int* it = std::lower_bound(it_begin, it_end, iRow);
-            if (it == it_end || (*it != iRow))
-                return 0; // no row
-
-            rowIdxInCol = (it - it_begin);
-            colData = Ax + Ap[iCol];
-            colData[rowIdxInCol] = 0;
-            break;
-        }
+            return WriteSnapshot(path, spmat_f64, triplets, opts, b, x);
+        case MatrixFormat_SinglePrecisionComplex:
+            return WriteSnapshot(path, spmat_c64, triplets, opts, b, x);
+        case MatrixFormat_SinglePrecisionReal:
+            return WriteSnapshot(path, spmat_f32, triplets, opts, b, x);
         default:
-        {
-            complex* colData;
-            int rowIdxInCol;
+            return WriteSnapshot(path, spmat, triplets, opts, b, x);
+    }
+}
 
-            complex* Ax = spmat.valuePtr();
-            int* Ap = spmat.outerIndexPtr();
-            int* Ai = spmat.innerIndexPtr();
-            const int numColElements = Ap[iCol + 1] - Ap[iCol];
-            const int* it_begin = (Ai) + Ap[iCol];
-            const int* it_end = (Ai) + Ap[iCol + 1];
+int KLUSystemX::LoadSnapshot(const char* path)
+{
+    if (!path)
+        return 0;
 
-            const int* it = std::lower_bound(it_begin, it_end, iRow);
-            if (it == it_end || (*it != iRow))
-                return 0; // no row
+    MappedFile file(path);
+    SnapshotFileHeader header;
+    size_t vectorsOffset;
+    if (!CheckSnapshot(file, header, vectorsOffset))
+        return 0;
 
-            rowIdxInCol = (it - it_begin);
-            colData = Ax + Ap[iCol];
-            colData[rowIdxInCol] = 0;
-            break;
-        }
-    }    
-    return 1;
-}
+    const uint32_t n = header.n;
+    const char* Ax = file.data() + sizeof(header);
+    const int32_t* Ap = reinterpret_cast<const int32_t*>(file.data() + file.size() - sizeof(int32_t) * (size_t(n) + 1 + header.nnz));
+    const int32_t* Ai = Ap + n + 1;
 
-int KLUSystemX::GetCompressedMatrix(unsigned int nColP, unsigned int nNZ, unsigned int* pColP, unsigned int* pRowIdx, complex* pMat)
-{
-    switch (dataFormat)
+    // the arrays are used as they are, only check that they form a valid matrix
+    if (Ap[0] != 0 || uint64_t(Ap[n]) != header.nnz)
+        return 0;
+    for (uint32_t j = 0; j < n; ++j)
     {
-        case MatrixFormat_DoublePrecisionReal:  
+        if (Ap[j + 1] < Ap[j])
+            return 0;
+        for (int32_t p = Ap[j]; p < Ap[j + 1]; ++p)
         {
-            if (triplets.size())
-            {
-                ProcessTriplets();
-            }
-
-            if (!spmat_f64.isCompressed())
-                spmat_f64.makeCompressed();
-
-            if (nNZ < spmat_f64.nonZeros() || nColP <= m_nBus || !spmat_f64.nonZeros())
+            if (Ai[p] < 0 || uint32_t(Ai[p]) >= n || (p > Ap[j] && Ai[p - 1] >= Ai[p]))
                 return 0;
-
-            double* Ax = spmat_f64.valuePtr();
-            int* Ap = spmat_f64.outerIndexPtr();
-            int* Ai = spmat_f64.innerIndexPtr();
-
-            memcpy(pMat, Ax, spmat_f64.nonZeros() * sizeof(complex));
-            memcpy(pColP, Ap, (spmat_f64.cols() + 1) * sizeof(int));
-            memcpy(pRowIdx, Ai, spmat_f64.nonZeros() * sizeof(int));
-
-            return spmat_f64.nonZeros();
         }
+    }
+
+    SetOptions(header.opts);
+    Initialize(n, 0, n);
+    switch (dataFormat)
+    {
+        case MatrixFormat_DoublePrecisionReal:
+            AssignCompressed(spmat_f64, n, header.nnz, Ap, Ai, Ax);
+            break;
+        case MatrixFormat_SinglePrecisionComplex:
+            AssignCompressed(spmat_c64, n, header.nnz, Ap, Ai, Ax);
+            break;
+        case MatrixFormat_SinglePrecisionReal:
+            AssignCompressed(spmat_f32, n, header.nnz, Ap, Ai, Ax);
+            break;
         default:
-        {
-            if (triplets.size())
-            {
-                ProcessTriplets();
-            }
+            AssignCompressed(spmat, n, header.nnz, Ap, Ai, Ax);
+            break;
+    }
+    m_NZpre = header.nnz;
+    ++matrixVersion;
+    stats.assembly.bytesAllocated += size_t(header.nnz) * (header.entrySize + sizeof(int32_t)) + size_t(n + 1) * sizeof(int32_t);
 
-            if (!spmat.isCompressed())
-                spmat.makeCompressed();
+    // already compressed, but not factored yet
+    samePattern = true;
+    return 1;
+}
 
-            if (nNZ < spmat.nonZeros() || nColP <= m_nBus || !spmat.nonZeros())
-                return 0;
+int KLUSystemX::ReadSnapshotVectors(const char* path, unsigned int n, double* b, double* x)
+{
+    if (!path)
+        return 0;
 
-            complex* Ax = spmat.valuePtr();
-            int* Ap = spmat.outerIndexPtr();
-            int* Ai = spmat.innerIndexPtr();
+    MappedFile file(path);
+    SnapshotFileHeader header;
+    size_t vectorsOffset;
+    if (!CheckSnapshot(file, header, vectorsOffset) || header.n != n)
+        return 0;
+    if ((b && !(header.contents & Snapshot_RHS)) || (x && !(header.contents & Snapshot_Solution)))
+        return 0;
 
-            memcpy(pMat, Ax, spmat.nonZeros() * sizeof(complex));
-            memcpy(pColP, Ap, (spmat.cols() + 1) * sizeof(int));
-            memcpy(pRowIdx, Ai, spmat.nonZeros() * sizeof(int));
-            return spmat.nonZeros();
-        }
+    const size_t vectorSize = size_t(header.entrySize) * n;
+    const char* pVector = file.data() + vectorsOffset;
+    if (header.contents & Snapshot_RHS)
+    {
+        if (b)
+            memcpy(b, pVector, vectorSize);
+        pVector += vectorSize;
     }
+    if (x)
+        memcpy(x, pVector, vectorSize);
+
+    return 1;
 }
 
-int KLUSystemX::GetTripletMatrix(unsigned int nNZ, unsigned int* pRows, unsigned int* pCols, complex* pMat)
+KLUSolveContextX::KLUSolveContextX(KLUSystemX* pSys_)
+    : pSys(pSys_)
+    , factorVersion(0)
 {
-    if (triplets.size())
-        ProcessTriplets();
-
-    switch (dataFormat)
-    {
-        case MatrixFormat_DoublePrecisionReal:  
-        {
-            if (!spmat_f64.isCompressed())
-                spmat_f64.makeCompressed();
+    klu_defaults(&Common);
+    Common.halt_if_singular = 0;
+    memset(&Numeric, 0, sizeof(Numeric));
+}
 
-            if (nNZ < spmat_f64.nonZeros() || !spmat_f64.nonZeros())
-                return 0;
+bool KLUSolveContextX::Sync()
+{
+    if (!pSys->bFactored || !pSys->HasFactorization())
+        return false;
 
-            for (int k = 0; k < spmat_f64.outerSize(); ++k)
-            {
-                for (SparseMatrixF64::InnerIterator it(spmat_f64, k); it; ++it)
-                {
-                    *(pMat++) = it.value();
-                    *(pRows++) = it.row();
-                    *(pCols++) = it.col();
-                }
-            }
-            return spmat_f64.nonZeros();
-        }
-        default:
-        {
-            if (!spmat.isCompressed())
-                spmat.makeCompressed();
+    if (factorVersion == pSys->factorVersion || pSys->UsesSparseLU())
+        return true;
 
-            if (nNZ < spmat.nonZeros() || !spmat.nonZeros())
-                return 0;
+    // klu_solve only writes to Numeric->Xwork, so all other
+    // (read-only) pointers can be shared with the system
+    const size_t entrySize = (pSys->dataFormat == MatrixFormat_DoublePrecisionReal) ? 1 : 2;
+    if (pSys->UsesBlockFactorization())
+    {
+        const size_t nBlocks = pSys->factorBlocks.size();
+        blockNumerics.resize(nBlocks);
+        blockNumericPtrs.resize(nBlocks);
+        size_t xworkSize = 0;
+        for (auto &b: pSys->factorBlocks)
+            xworkSize += 4 * entrySize * size_t(b.Numeric->n);
 
-            for (int k = 0; k < spmat.outerSize(); ++k)
-            {
-                for (SparseMatrix::InnerIterator it(spmat, k); it; ++it)
-                {
-                    *(pMat++) = it.value();
-                    *(pRows++) = it.row();
-                    *(pCols++) = it.col();
-                }
-            }
-            return spmat.nonZeros();
+        xwork.resize(xworkSize);
+        double* pXwork = xwork.data();
+        for (size_t k = 0; k < nBlocks; ++k)
+        {
+            blockNumerics[k] = *pSys->factorBlocks[k].Numeric;
+            blockNumerics[k].Xwork = pXwork;
+            blockNumericPtrs[k] = &blockNumerics[k];
+            pXwork += 4 * entrySize * size_t(blockNumerics[k].n);
         }
+        factorVersion = pSys->factorVersion;
+        return true;
     }
+    Numeric = *pSys->Numeric;
+    xwork.resize(4 * entrySize * size_t(Numeric.n));
+    Numeric.Xwork = xwork.data();
+    factorVersion = pSys->factorVersion;
+    return true;
 }
 
-int KLUSystemX::SaveAsMarketFiles(const char* fileNameMatrix, const double *b, const char* fileNameVector)
+int KLUSolveContextX::SolveSystem(complex* acxX, complex* acxB)
 {
-    bool res = 0;
-    if (triplets.size())
-        ProcessTriplets();
+    if (!Sync())
+        return 0;
 
-    switch (dataFormat)
+    const uint32_t n = pSys->m_nBus;
+    if (n < 1)
+        return 1;
+
+    if (pSys->IsRefinementRequired())
     {
-        case MatrixFormat_DoublePrecisionReal:  
-            res = Eigen::saveMarket(spmat_f64, fileNameMatrix);
-            if (!res)
-            {
-                return 0;
-            }
-            if (b)
-            {
-                Eigen::VectorXd Bcopy = Eigen::Map<const Eigen::VectorXd>(b, spmat_f64.rows());
-                res = Eigen::saveMarketVector(Bcopy, fileNameVector);
-            }
+        // the shared factorization cannot be refreshed here, report it instead
+        if (acxX != acxB)
+            memcpy(acxX, acxB, pSys->GetEntrySize() * n);
+        double residual;
+        pSys->SolveRefined(acxX, &Numeric, &Common, refineWork, residual);
+        return (residual <= pSys->refinementTolerance) ? 1 : 2;
+    }
+    if (pSys->UsesBlockFactorization())
+    {
+        if (acxX != acxB)
+            memcpy(acxX, acxB, pSys->GetEntrySize() * n);
+        pSys->SolveBlocks(acxX, 1, n, blockNumericPtrs.data(), &Common, blockWork);
+        return (Common.status == KLU_OK) ? 1 : 0;
+    }
+    switch (pSys->dataFormat)
+    {
+        case MatrixFormat_SinglePrecisionComplex:
+        case MatrixFormat_SinglePrecisionReal:
+            // Eigen's solve doesn't modify the factorization
+            if (acxX != acxB)
+                memcpy(acxX, acxB, pSys->GetEntrySize() * n);
+            pSys->SolveSinglePrecision(acxX, 1, n);
+            return 1;
+        case MatrixFormat_DoublePrecisionReal:
+            if (acxX != acxB)
+                memcpy(acxX, acxB, sizeof(double) * n);
+            klu_solve(pSys->Symbolic, &Numeric, n, 1, reinterpret_cast<double*>(acxX), &Common);
             break;
         default:
-        {
-            res = Eigen::saveMarket(spmat, fileNameMatrix);
-            if (!res)
-            {
-                return 0;
-            }
-            if (b)
-            {
-                res = Eigen::saveMarketVector(Eigen::Map<const Eigen::VectorXcd>(reinterpret_cast<const complex*>(b), spmat.rows()), fileNameVector);
-            }
+            if (acxX != acxB)
+                memcpy(acxX, acxB, sizeof(complex) * n);
+            klu_z_solve(pSys->Symbolic, &Numeric, n, 1, reinterpret_cast<double*>(acxX), &Common);
             break;
-        }
     }
-    if (!res)
-    {
+    if (Common.status != KLU_OK)
         return 0;
-    }
+
+    pSys->ApplyLowRankCorrection(acxX, 1, n);
     return 1;
 }
 
-} // namespace KLUSolveX
\ No newline at end of file
+} // namespace KLUSolveX
@@ -11,44 +11,399 @@
 #endif
 #include <cstdint>
 
+#include "KLUSolveX.h"
 #include <Eigen/Eigen>
+#include <algorithm>
+#include <atomic>
 #include <complex>
 
-extern "C" void mvmult(int32_t N, double* b_, double* A_, double* x_)
+#if defined(__x86_64__) || (defined(_M_X64) && _MSC_VER >= 1911)
+#define KLUSOLVEX_MVMULT_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(KLUSOLVEX_NEON_KERNELS) && (defined(__aarch64__) || defined(_M_ARM64))
+// not verified on ARM64 hardware yet, so only built on request
+#define KLUSOLVEX_MVMULT_NEON
+#include <arm_neon.h>
+#endif
+
+// The SIMD kernels are compiled for their instruction set whatever the target of
+// the build, and only used after checking the CPU
+#if defined(_MSC_VER) && !defined(__clang__)
+#define KLUSOLVEX_TARGET(isa)
+#define KLUSOLVEX_FORCEINLINE __forceinline
+#else
+#define KLUSOLVEX_TARGET(isa) __attribute__((target(isa)))
+#define KLUSOLVEX_FORCEINLINE inline __attribute__((always_inline))
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+// the vectors are only passed between functions of the same instruction set
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+namespace
+{
+
+typedef std::complex<double> Complex;
+
+// b = A * x for count consecutive N x N matrices (column-major) and vectors
+typedef void (*BatchKernel)(int32_t count, int32_t N, Complex* b, const Complex* A, const Complex* x);
+
+template <int N_>
+void MultiplyBatch(int32_t count, int32_t /*N*/, Complex* b, const Complex* A, const Complex* x)
+{
+    using namespace Eigen;
+    typedef Matrix<Complex, N_, 1> VectorN;
+    typedef Matrix<Complex, N_, N_> MatrixN;
+
+    for (int32_t k = 0; k < count; ++k, b += N_, A += N_ * N_, x += N_)
+        Map<VectorN>(b).noalias() = Map<const MatrixN>(A) * Map<const VectorN>(x);
+}
+
+// no matrix product for 1x1, a plain loop is vectorized across the elements
+template <>
+void MultiplyBatch<1>(int32_t count, int32_t /*N*/, Complex* b, const Complex* A, const Complex* x)
+{
+    for (int32_t k = 0; k < count; ++k)
+        b[k] = A[k] * x[k];
+}
+
+void MultiplyBatchDynamic(int32_t count, int32_t N, Complex* b, const Complex* A, const Complex* x)
 {
-    typedef std::complex<double> Complex;
     using namespace Eigen;
-    typedef Matrix<Complex, 6, 1> Vector6cd;
-    typedef Matrix<Complex, 6, 6> Matrix6cd;
-    typedef Matrix<Complex, 8, 1> Vector8cd;
-    typedef Matrix<Complex, 8, 8> Matrix8cd;
+    const size_t NN = size_t(N) * N;
+    for (int32_t k = 0; k < count; ++k, b += N, A += NN, x += N)
+        Map<VectorXcd>(b, N).noalias() = Map<const MatrixXcd>(A, N, N) * Map<const VectorXcd>(x, N);
+}
+
+/*
+SIMD kernels, with the complex values kept interleaved as stored. Each column
+of A is multiplied by x[j] as A(:, j) * re(x[j]) + swap(A(:, j)) * (-im, +im),
+swap exchanging the real and imaginary parts, with both terms accumulated
+separately for the whole product. V provides the vector operations of an
+instruction set on width doubles; Load and Store take the number of doubles
+left, for the partial vector at the end of a column.
+*/
+template <int N, class V>
+KLUSOLVEX_FORCEINLINE void MultiplySimd(int32_t count, Complex* b_, const Complex* A_, const Complex* x_)
+{
+    typedef typename V::Vector Vector;
+    double* b = (double*)b_;
+    const double* A = (const double*)A_;
+    const double* x = (const double*)x_;
 
-    Complex* A = (Complex*)A_;
-    Complex* x = (Complex*)x_;
+    if (N == 1)
+    {
+        // element by element, as a single vector of complex values
+        const Vector signs = V::SetSigned(1);
+        const int64_t total = 2 * int64_t(count);
+        for (int64_t i = 0; i < total; i += V::width)
+        {
+            const int left = int(std::min<int64_t>(V::width, total - i));
+            const Vector a = V::Load(A + i, left), xv = V::Load(x + i, left);
+            V::Store(b + i, V::Fma(V::Swap(a), V::Mul(V::DupImag(xv), signs), V::Mul(a, V::DupReal(xv))), left);
+        }
+        return;
+    }
+
+    const int D = 2 * N; // doubles per column
+    const int R = (D + V::width - 1) / V::width; // vectors per column
+    for (int32_t k = 0; k < count; ++k, b += D, A += D * N, x += D)
+    {
+        Vector byReal[R], byImag[R];
+        for (int r = 0; r < R; ++r)
+            byReal[r] = byImag[r] = V::Zero();
+
+        for (int j = 0; j < N; ++j)
+        {
+            const Vector xr = V::Set1(x[2 * j]), xi = V::SetSigned(x[2 * j + 1]);
+            for (int r = 0; r < R; ++r)
+            {
+                const Vector a = V::Load(A + j * D + r * V::width, D - r * V::width);
+                byReal[r] = V::Fma(a, xr, byReal[r]);
+                byImag[r] = V::Fma(V::Swap(a), xi, byImag[r]);
+            }
+        }
+        for (int r = 0; r < R; ++r)
+            V::Store(b + r * V::width, V::Add(byReal[r], byImag[r]), D - r * V::width);
+    }
+}
+
+#ifdef KLUSOLVEX_MVMULT_X86
+struct AVX2
+{
+    typedef __m256d Vector;
+    static const int width = 4;
+
+    KLUSOLVEX_TARGET("avx2,fma") static inline __m256i Mask(int n)
+    {
+        return _mm256_setr_epi64x(-1, n > 1 ? -1 : 0, n > 2 ? -1 : 0, 0);
+    }
+    KLUSOLVEX_TARGET("avx2,fma") static inline Vector Load(const double* p, int n)
+    {
+        return (n >= width) ? _mm256_loadu_pd(p) : _mm256_maskload_pd(p, Mask(n));
+    }
+    KLUSOLVEX_TARGET("avx2,fma") static inline void Store(double* p, Vector v, int n)
+    {
+        if (n >= width)
+            _mm256_storeu_pd(p, v);
+        else
+            _mm256_maskstore_pd(p, Mask(n), v);
+    }
+    KLUSOLVEX_TARGET("avx2,fma") static inline Vector Zero() { return _mm256_setzero_pd(); }
+    KLUSOLVEX_TARGET("avx2,fma") static inline Vector Set1(double v) { return _mm256_set1_pd(v); }
+    KLUSOLVEX_TARGET("avx2,fma") static inline Vector SetSigned(double v) { return _mm256_setr_pd(-v, v, -v, v); }
+    KLUSOLVEX_TARGET("avx2,fma") static inline Vector Add(Vector a, Vector b) { return _mm256_add_pd(a, b); }
+    KLUSOLVEX_TARGET("avx2,fma") static inline Vector Mul(Vector a, Vector b) { return _mm256_mul_pd(a, b); }
+    KLUSOLVEX_TARGET("avx2,fma") static inline Vector Fma(Vector a, Vector b, Vector c) { return _mm256_fmadd_pd(a, b, c); }
+    KLUSOLVEX_TARGET("avx2,fma") static inline Vector Swap(Vector a) { return _mm256_permute_pd(a, 0x5); }
+    KLUSOLVEX_TARGET("avx2,fma") static inline Vector DupReal(Vector a) { return _mm256_movedup_pd(a); }
+    KLUSOLVEX_TARGET("avx2,fma") static inline Vector DupImag(Vector a) { return _mm256_permute_pd(a, 0xF); }
+};
+
+struct AVX512
+{
+    typedef __m512d Vector;
+    static const int width = 8;
+
+    KLUSOLVEX_TARGET("avx512f") static inline Vector Load(const double* p, int n)
+    {
+        return (n >= width) ? _mm512_loadu_pd(p) : _mm512_maskz_loadu_pd(__mmask8((1u << n) - 1), p);
+    }
+    KLUSOLVEX_TARGET("avx512f") static inline void Store(double* p, Vector v, int n)
+    {
+        if (n >= width)
+            _mm512_storeu_pd(p, v);
+        else
+            _mm512_mask_storeu_pd(p, __mmask8((1u << n) - 1), v);
+    }
+    KLUSOLVEX_TARGET("avx512f") static inline Vector Zero() { return _mm512_setzero_pd(); }
+    KLUSOLVEX_TARGET("avx512f") static inline Vector Set1(double v) { return _mm512_set1_pd(v); }
+    KLUSOLVEX_TARGET("avx512f") static inline Vector SetSigned(double v) { return _mm512_setr_pd(-v, v, -v, v, -v, v, -v, v); }
+    KLUSOLVEX_TARGET("avx512f") static inline Vector Add(Vector a, Vector b) { return _mm512_add_pd(a, b); }
+    KLUSOLVEX_TARGET("avx512f") static inline Vector Mul(Vector a, Vector b) { return _mm512_mul_pd(a, b); }
+    KLUSOLVEX_TARGET("avx512f") static inline Vector Fma(Vector a, Vector b, Vector c) { return _mm512_fmadd_pd(a, b, c); }
+    KLUSOLVEX_TARGET("avx512f") static inline Vector Swap(Vector a) { return _mm512_shuffle_pd(a, a, 0x55); }
+    KLUSOLVEX_TARGET("avx512f") static inline Vector DupReal(Vector a) { return _mm512_shuffle_pd(a, a, 0x00); }
+    KLUSOLVEX_TARGET("avx512f") static inline Vector DupImag(Vector a) { return _mm512_shuffle_pd(a, a, 0xFF); }
+};
+
+template <int N>
+KLUSOLVEX_TARGET("avx2,fma") void MultiplyBatchAVX2(int32_t count, int32_t /*N*/, Complex* b, const Complex* A, const Complex* x)
+{
+    MultiplySimd<N, AVX2>(count, b, A, x);
+}
+
+template <int N>
+KLUSOLVEX_TARGET("avx512f") void MultiplyBatchAVX512(int32_t count, int32_t /*N*/, Complex* b, const Complex* A, const Complex* x)
+{
+    MultiplySimd<N, AVX512>(count, b, A, x);
+}
+
+void CPUID(int leaf, int subleaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+    __cpuidex((int*)regs, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// register state enabled by the OS
+uint64_t XGETBV()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (uint64_t(edx) << 32) | eax;
+#endif
+}
+
+bool CPUSupports(int32_t kernels)
+{
+    unsigned int regs[4];
+    CPUID(0, 0, regs);
+    if (regs[0] < 7)
+        return false;
+
+    CPUID(1, 0, regs);
+    const bool osxsave = (regs[2] >> 27) & 1, fma = (regs[2] >> 12) & 1;
+    if (!osxsave)
+        return false;
+    const uint64_t xcr0 = XGETBV();
+
+    CPUID(7, 0, regs);
+    switch (kernels)
+    {
+    case MvmultKernels_AVX2:
+        return fma && ((regs[1] >> 5) & 1) && (xcr0 & 0x6) == 0x6;
+    case MvmultKernels_AVX512:
+        return ((regs[1] >> 16) & 1) && (xcr0 & 0xE6) == 0xE6;
+    }
+    return false;
+}
+#endif // KLUSOLVEX_MVMULT_X86
+
+#ifdef KLUSOLVEX_MVMULT_NEON
+struct NEON
+{
+    typedef float64x2_t Vector;
+    static const int width = 2;
+
+    static inline Vector Load(const double* p, int /*n*/) { return vld1q_f64(p); }
+    static inline void Store(double* p, Vector v, int /*n*/) { vst1q_f64(p, v); }
+    static inline Vector Zero() { return vdupq_n_f64(0); }
+    static inline Vector Set1(double v) { return vdupq_n_f64(v); }
+    static inline Vector SetSigned(double v)
+    {
+        const double values[2] = { -v, v };
+        return vld1q_f64(values);
+    }
+    static inline Vector Add(Vector a, Vector b) { return vaddq_f64(a, b); }
+    static inline Vector Mul(Vector a, Vector b) { return vmulq_f64(a, b); }
+    static inline Vector Fma(Vector a, Vector b, Vector c) { return vfmaq_f64(c, a, b); }
+    static inline Vector Swap(Vector a) { return vextq_f64(a, a, 1); }
+    static inline Vector DupReal(Vector a) { return vdupq_laneq_f64(a, 0); }
+    static inline Vector DupImag(Vector a) { return vdupq_laneq_f64(a, 1); }
+};
+
+template <int N>
+void MultiplyBatchNEON(int32_t count, int32_t /*N*/, Complex* b, const Complex* A, const Complex* x)
+{
+    MultiplySimd<N, NEON>(count, b, A, x);
+}
+#endif // KLUSOLVEX_MVMULT_NEON
+
+// kernels of an instruction set, by order up to 8; other orders use the dynamic Eigen kernel
+struct KernelSet
+{
+    int32_t id;
+    BatchKernel kernels[9];
+};
+
+const KernelSet genericKernels = { MvmultKernels_Generic, { nullptr, MultiplyBatch<1>, MultiplyBatch<2>, MultiplyBatch<3>, MultiplyBatch<4>, nullptr, MultiplyBatch<6>, nullptr, MultiplyBatch<8> } };
+#ifdef KLUSOLVEX_MVMULT_X86
+const KernelSet avx2Kernels = { MvmultKernels_AVX2, { nullptr, MultiplyBatchAVX2<1>, MultiplyBatchAVX2<2>, MultiplyBatchAVX2<3>, MultiplyBatchAVX2<4>, nullptr, MultiplyBatchAVX2<6>, nullptr, MultiplyBatchAVX2<8> } };
+const KernelSet avx512Kernels = { MvmultKernels_AVX512, { nullptr, MultiplyBatchAVX512<1>, MultiplyBatchAVX512<2>, MultiplyBatchAVX512<3>, MultiplyBatchAVX512<4>, nullptr, MultiplyBatchAVX512<6>, nullptr, MultiplyBatchAVX512<8> } };
+#endif
+#ifdef KLUSOLVEX_MVMULT_NEON
+const KernelSet neonKernels = { MvmultKernels_NEON, { nullptr, MultiplyBatchNEON<1>, MultiplyBatchNEON<2>, MultiplyBatchNEON<3>, MultiplyBatchNEON<4>, nullptr, MultiplyBatchNEON<6>, nullptr, MultiplyBatchNEON<8> } };
+#endif
+
+// the kernel set, if built and supported by this CPU; the best one for MvmultKernels_Auto
+const KernelSet* FindKernels(int32_t kernels)
+{
+    switch (kernels)
+    {
+    case MvmultKernels_Auto:
+#ifdef KLUSOLVEX_MVMULT_X86
+        if (CPUSupports(MvmultKernels_AVX512))
+            return &avx512Kernels;
+        if (CPUSupports(MvmultKernels_AVX2))
+            return &avx2Kernels;
+#endif
+#ifdef KLUSOLVEX_MVMULT_NEON
+        return &neonKernels;
+#endif
+        return &genericKernels;
+    case MvmultKernels_Generic:
+        return &genericKernels;
+#ifdef KLUSOLVEX_MVMULT_X86
+    case MvmultKernels_AVX2:
+        return CPUSupports(kernels) ? &avx2Kernels : nullptr;
+    case MvmultKernels_AVX512:
+        return CPUSupports(kernels) ? &avx512Kernels : nullptr;
+#endif
+#ifdef KLUSOLVEX_MVMULT_NEON
+    case MvmultKernels_NEON:
+        return &neonKernels;
+#endif
+    }
+    return nullptr;
+}
+
+std::atomic<const KernelSet*>& CurrentKernels()
+{
+    static std::atomic<const KernelSet*> current(FindKernels(MvmultKernels_Auto));
+    return current;
+}
+
+BatchKernel GetBatchKernel(int32_t N)
+{
+    if (N <= 8)
+    {
+        const BatchKernel kernel = CurrentKernels().load(std::memory_order_relaxed)->kernels[N];
+        if (kernel)
+            return kernel;
+    }
+    return MultiplyBatchDynamic;
+}
+
+} // namespace
+
+void KLUSOLVEX_STDCALL mvmult(int32_t N, complex* b_, complex* A_, complex* x_)
+{
+    GetBatchKernel(N)(1, N, (Complex*)b_, (Complex*)A_, (Complex*)x_);
+}
+
+int32_t KLUSOLVEX_STDCALL mvmult_kernels(int32_t kernels)
+{
+    const KernelSet* set = FindKernels(kernels);
+    if (!set)
+        return 0;
+
+    CurrentKernels().store(set);
+    return set->id;
+}
+
+void KLUSOLVEX_STDCALL mvmult_batch(int32_t count, int32_t N, complex* b_, complex* A_, complex* x_)
+{
+    if (count <= 0 || N <= 0)
+        return;
+
+    GetBatchKernel(N)(count, N, (Complex*)b_, (Complex*)A_, (Complex*)x_);
+}
+
+void KLUSOLVEX_STDCALL mvmult_ragged(int32_t count, int32_t* pN, int32_t* pVectorOffsets, int32_t* pMatrixOffsets, complex* b_, complex* A_, complex* x_)
+{
     Complex* b = (Complex*)b_;
+    const Complex* A = (Complex*)A_;
+    const Complex* x = (Complex*)x_;
+    int64_t vectorOffset = 0, matrixOffset = 0;
+
+    // consecutive elements of the same order and packed storage go to the kernel together
+    int32_t k = 0;
+    while (k < count)
+    {
+        const int32_t N = std::max(pN[k], 0);
+        if (pVectorOffsets)
+            vectorOffset = pVectorOffsets[k];
+        if (pMatrixOffsets)
+            matrixOffset = pMatrixOffsets[k];
+
+        int32_t run = 1;
+        int64_t nextVector = vectorOffset + N, nextMatrix = matrixOffset + int64_t(N) * N;
+        while (k + run < count && pN[k + run] == N
+            && (!pVectorOffsets || pVectorOffsets[k + run] == nextVector)
+            && (!pMatrixOffsets || pMatrixOffsets[k + run] == nextMatrix))
+        {
+            ++run;
+            nextVector += N;
+            nextMatrix += int64_t(N) * N;
+        }
+
+        if (N > 0)
+            GetBatchKernel(N)(run, N, b + vectorOffset, A + matrixOffset, x + vectorOffset);
 
-    switch (N)
-    {
-    case 1:
-        b[0] = A[0] * x[0];
-        break;
-    case 2:
-        Map<Vector2cd>(b).noalias() = Map<Matrix2cd>(A) * Map<Vector2cd>(x);
-        break;
-    case 3:
-        Map<Vector3cd>(b).noalias() = Map<Matrix3cd>(A) * Map<Vector3cd>(x);
-        break;
-    case 4:
-        Map<Vector4cd>(b).noalias() = Map<Matrix4cd>(A) * Map<Vector4cd>(x);
-        break;
-    case 6:
-        Map<Vector6cd>(b).noalias() = Map<Matrix6cd>(A) * Map<Vector6cd>(x);
-        break;
-    case 8:
-        Map<Vector8cd>(b).noalias() = Map<Matrix8cd>(A) * Map<Vector8cd>(x);
-        break;
-    default:
-        Map<VectorXcd>(b, N).noalias() = Map<MatrixXcd>(A, N, N) * Map<VectorXcd>(x, N);
-        break;
+        vectorOffset = nextVector;
+        matrixOffset = nextMatrix;
+        k += run;
     }
 }
@@ -0,0 +1,108 @@
+/* ------------------------------------------------------------------------- */
+/* DSS-Extensions KLUSolve (KLUSolveX)                                       */
+/* Copyright (c) 2019-2024, Paulo Meira                                      */
+/* Licensed under the GNU Lesser General Public License (LGPL) v 2.1         */
+/* ------------------------------------------------------------------------- */
+
+// Helpers for the KLUSolveX tests. Each test compares a feature against a
+// plain factor-and-solve of the same matrix, on the synthetic feeders of the
+// benchmark, and returns non-zero from main if any check failed.
+
+#ifndef DSS_EXTENSIONS_KLUSOLVEX_TEST_COMMON_H
+#define DSS_EXTENSIONS_KLUSOLVEX_TEST_COMMON_H
+
+#include "KLUSolveX.h"
+#include "feeder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+typedef std::vector<std::complex<double>> CVector;
+
+static int testFailures = 0;
+
+#define TEST_CHECK(cond) \
+    do { \
+        if (!(cond)) \
+        { \
+            std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            ++testFailures; \
+        } \
+    } while (0)
+
+inline complex* AsComplex(std::complex<double>* p)
+{
+    return reinterpret_cast<complex*>(p);
+}
+
+inline void AddFeeder(void* handle, const Feeder& feeder)
+{
+    for (const Primitive& p : feeder.primitives)
+    {
+        AddPrimitiveMatrix(handle, p.nodes.size(), const_cast<unsigned int*>(p.nodes.data()), AsComplex(const_cast<std::complex<double>*>(p.Y.data())));
+    }
+}
+
+// new sparse set with the feeder matrix, not factored yet
+inline void* NewFeederSet(const Feeder& feeder, uint64_t opts)
+{
+    void* handle = NewSparseSet(feeder.nNodes);
+    SetOptions(handle, opts);
+    AddFeeder(handle, feeder);
+    return handle;
+}
+
+inline CVector RandomInjections(unsigned int n, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> dist(-1, 1);
+    CVector B(n);
+    for (auto &b: B)
+        b = std::complex<double>(dist(rng), dist(rng));
+    return B;
+}
+
+inline int Solve(void* handle, CVector& X, CVector& B)
+{
+    X.resize(B.size());
+    return SolveSparseSet(handle, AsComplex(X.data()), AsComplex(B.data()));
+}
+
+// plain factor-and-solve of a fresh sparse set, the reference for the tests
+inline CVector ReferenceSolve(const Feeder& feeder, CVector B)
+{
+    void* handle = NewFeederSet(feeder, 0);
+    CVector X;
+    TEST_CHECK(Solve(handle, X, B) == 1);
+    DeleteSparseSet(handle);
+    return X;
+}
+
+// max|x - y| / max|y|
+inline double RelativeDiff(const CVector& x, const CVector& y)
+{
+    double diff = 0, scale = 0;
+    for (size_t k = 0; k < x.size(); ++k)
+    {
+        diff = std::max(diff, std::abs(x[k] - y[k]));
+        scale = std::max(scale, std::abs(y[k]));
+    }
+    return diff / scale;
+}
+
+const double testTolerance = 1e-9;
+
+inline int TestResult(const char* name)
+{
+    if (testFailures)
+        std::printf("%s: %d check(s) failed\n", name, testFailures);
+    else
+        std::printf("%s: passed\n", name);
+    return testFailures ? 1 : 0;
+}
+
+#endif // #ifndef DSS_EXTENSIONS_KLUSOLVEX_TEST_COMMON_H
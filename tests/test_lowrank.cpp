@@ -0,0 +1,73 @@
+/* ------------------------------------------------------------------------- */
+/* DSS-Extensions KLUSolve (KLUSolveX)                                       */
+/* Copyright (c) 2019-2024, Paulo Meira                                      */
+/* Licensed under the GNU Lesser General Public License (LGPL) v 2.1         */
+/* ------------------------------------------------------------------------- */
+
+// AddLowRankUpdate: the corrected solves must match a plain factorization of
+// the changed matrix, and ClearLowRankUpdates must restore the original one.
+
+#include "test_common.h"
+
+int main()
+{
+    const Feeder feeder = GenerateFeeder(90, 0.1, 7);
+    const unsigned int n = feeder.nNodes;
+    CVector B = RandomInjections(n, 11);
+
+    // a parallel line between buses 0 and 1, which are always connected;
+    // all its entries are already in the matrix
+    Primitive change = MakeLine(0, 1, 1.0);
+    std::vector<unsigned int> rows, cols;
+    for (unsigned int j = 0; j < 6; ++j)
+    {
+        for (unsigned int i = 0; i < 6; ++i)
+        {
+            rows.push_back(change.nodes[i]);
+            cols.push_back(change.nodes[j]);
+        }
+    }
+    Feeder changed = feeder;
+    changed.primitives.push_back(change);
+
+    const CVector X0 = ReferenceSolve(feeder, B);
+    const CVector X1 = ReferenceSolve(changed, B);
+
+    void* handle = NewFeederSet(feeder, 0);
+    CVector X(n);
+    TEST_CHECK(Solve(handle, X, B) == 1);
+    TEST_CHECK(RelativeDiff(X, X0) < testTolerance);
+    complex y11;
+    GetMatrixElement(handle, 1, 1, &y11);
+
+    TEST_CHECK(AddLowRankUpdate(handle, rows.size(), rows.data(), cols.data(), AsComplex(change.Y.data())) == 1);
+    TEST_CHECK(Solve(handle, X, B) == 1);
+    TEST_CHECK(RelativeDiff(X, X1) < testTolerance);
+
+    // solve contexts apply the correction too
+    void* ctx = NewSolveContext(handle);
+    TEST_CHECK(SolveSparseSetWithContext(ctx, AsComplex(X.data()), AsComplex(B.data())) == 1);
+    TEST_CHECK(RelativeDiff(X, X1) < testTolerance);
+    DeleteSolveContext(ctx);
+
+    // an entry outside the pattern rejects the whole update
+    unsigned int farRow = n, farCol = 1;
+    complex one = { 1, 0 };
+    TEST_CHECK(AddLowRankUpdate(handle, 1, &farRow, &farCol, &one) == 0);
+
+    TEST_CHECK(ClearLowRankUpdates(handle) == 1);
+    TEST_CHECK(Solve(handle, X, B) == 1);
+    TEST_CHECK(RelativeDiff(X, X0) < testTolerance);
+    complex y11Reverted;
+    GetMatrixElement(handle, 1, 1, &y11Reverted);
+    TEST_CHECK(std::abs(y11Reverted.x - y11.x) <= 1e-12 * std::abs(y11.x) && std::abs(y11Reverted.y - y11.y) <= 1e-12 * std::abs(y11.y));
+
+    // over the rank limit, the changed matrix is refactored instead
+    SetLowRankLimit(handle, 2);
+    TEST_CHECK(AddLowRankUpdate(handle, rows.size(), rows.data(), cols.data(), AsComplex(change.Y.data())) == 2);
+    TEST_CHECK(Solve(handle, X, B) == 1);
+    TEST_CHECK(RelativeDiff(X, X1) < testTolerance);
+
+    DeleteSparseSet(handle);
+    return TestResult("lowrank");
+}
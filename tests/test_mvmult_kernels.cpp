@@ -0,0 +1,84 @@
+/* ------------------------------------------------------------------------- */
+/* DSS-Extensions KLUSolve (KLUSolveX)                                       */
+/* Copyright (c) 2019-2024, Paulo Meira                                      */
+/* Licensed under the GNU Lesser General Public License (LGPL) v 2.1         */
+/* ------------------------------------------------------------------------- */
+
+// mvmult_kernels: every kernel set supported by the CPU and build, then
+// MvmultKernels_Auto, must match a plain product in mvmult_batch. Odd counts
+// cover the partial vectors of N == 1, and the outputs are followed by guard
+// values that must not be written.
+
+#include "test_common.h"
+
+const struct
+{
+    int32_t kernels;
+    const char* name;
+} kernelSets[] = {
+    { MvmultKernels_Generic, "generic" },
+    { MvmultKernels_AVX2, "avx2" },
+    { MvmultKernels_AVX512, "avx512" },
+    { MvmultKernels_NEON, "neon" },
+    { MvmultKernels_Auto, "auto" }
+};
+
+static void CheckKernels(const char* name)
+{
+    const int32_t orders[] = { 1, 2, 3, 4, 6, 8 };
+    const int32_t counts[] = { 1, 3, 7, 33 };
+    const std::complex<double> guard(-7.5, 7.5);
+    for (int32_t N : orders)
+    {
+        for (int32_t count : counts)
+        {
+            CVector A(size_t(count) * N * N), x(size_t(count) * N), b(size_t(count) * N + 4, guard);
+            for (size_t i = 0; i < A.size(); ++i)
+                A[i] = std::complex<double>(1 + 0.37 * double(i % 11), -0.5 + 0.29 * double(i % 13));
+            for (size_t i = 0; i < x.size(); ++i)
+                x[i] = std::complex<double>(0.3 - 0.11 * double(i % 5), 1 + 0.07 * double(i % 9));
+
+            mvmult_batch(count, N, AsComplex(b.data()), AsComplex(A.data()), AsComplex(x.data()));
+            int errors = 0;
+            for (int32_t k = 0; k < count; ++k)
+            {
+                for (int32_t i = 0; i < N; ++i)
+                {
+                    std::complex<double> expected = 0;
+                    double scale = 0;
+                    for (int32_t j = 0; j < N; ++j)
+                    {
+                        const std::complex<double> term = A[size_t(k) * N * N + size_t(j) * N + i] * x[size_t(k) * N + j];
+                        expected += term;
+                        scale += std::abs(term);
+                    }
+                    if (!(std::abs(b[size_t(k) * N + i] - expected) <= 1e-14 * scale))
+                        ++errors;
+                }
+            }
+            for (size_t i = size_t(count) * N; i < b.size(); ++i)
+            {
+                if (b[i] != guard)
+                    ++errors;
+            }
+            if (errors)
+                std::printf("%s kernels, N=%d, count=%d:\n", name, N, count);
+            TEST_CHECK(errors == 0);
+        }
+    }
+}
+
+int main()
+{
+    for (const auto& s : kernelSets)
+    {
+        const int32_t selected = mvmult_kernels(s.kernels);
+        if (s.kernels == MvmultKernels_Auto)
+            TEST_CHECK(selected != 0);
+        if (!selected)
+            continue; // not supported by this CPU or build
+
+        CheckKernels(s.name);
+    }
+    return TestResult("mvmult_kernels");
+}
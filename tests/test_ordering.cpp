@@ -0,0 +1,54 @@
+/* ------------------------------------------------------------------------- */
+/* DSS-Extensions KLUSolve (KLUSolveX)                                       */
+/* Copyright (c) 2019-2024, Paulo Meira                                      */
+/* Licensed under the GNU Lesser General Public License (LGPL) v 2.1         */
+/* ------------------------------------------------------------------------- */
+
+// SetOrdering: the solves with each fill-reducing ordering, METIS included,
+// must match a plain factorization with KLU's default.
+
+#include "test_common.h"
+
+static void CheckOrdering(const Feeder& feeder, CVector& B, const CVector& X0, unsigned int method, std::vector<int32_t>* pPerm)
+{
+    void* handle = NewSparseSet(feeder.nNodes);
+    TEST_CHECK(SetOrdering(handle, method, pPerm ? pPerm->size() : 0, pPerm ? pPerm->data() : nullptr) == 1);
+    AddFeeder(handle, feeder);
+    CVector X;
+    TEST_CHECK(Solve(handle, X, B) == 1);
+    TEST_CHECK(RelativeDiff(X, X0) < testTolerance);
+
+    // the ordering is kept for a new pattern
+    ZeroSparseSet(handle);
+    AddFeeder(handle, feeder);
+    TEST_CHECK(Solve(handle, X, B) == 1);
+    TEST_CHECK(RelativeDiff(X, X0) < testTolerance);
+    DeleteSparseSet(handle);
+}
+
+int main()
+{
+    // two meshed islands, so that each BTF block is ordered on its own
+    const Feeder feeder = GenerateIslands(180, 2, 0.1, 4);
+    const unsigned int n = feeder.nNodes;
+    CVector B = RandomInjections(n, 8);
+    const CVector X0 = ReferenceSolve(feeder, B);
+
+    CheckOrdering(feeder, B, X0, Ordering_AMD, nullptr);
+    CheckOrdering(feeder, B, X0, Ordering_COLAMD, nullptr);
+    CheckOrdering(feeder, B, X0, Ordering_METIS, nullptr);
+
+    std::vector<int32_t> perm(n);
+    for (unsigned int k = 0; k < n; ++k)
+        perm[k] = n - 1 - k;
+    CheckOrdering(feeder, B, X0, Ordering_Given, &perm);
+
+    void* handle = NewSparseSet(n);
+    TEST_CHECK(SetOrdering(handle, Ordering_Given + 1, 0, nullptr) == 0);
+    perm[0] = perm[1];
+    TEST_CHECK(SetOrdering(handle, Ordering_Given, n, perm.data()) == 0);
+    TEST_CHECK(SetOrdering(handle, Ordering_Given, n - 1, perm.data()) == 0);
+    DeleteSparseSet(handle);
+
+    return TestResult("ordering");
+}
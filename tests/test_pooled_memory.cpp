@@ -0,0 +1,55 @@
+/* ------------------------------------------------------------------------- */
+/* DSS-Extensions KLUSolve (KLUSolveX)                                       */
+/* Copyright (c) 2019-2024, Paulo Meira                                      */
+/* Licensed under the GNU Lesser General Public License (LGPL) v 2.1         */
+/* ------------------------------------------------------------------------- */
+
+// Option_PooledKLUMemory: the solves must match a plain factorization, and a
+// rebuild of the same system must reuse the memory KLU freed.
+
+#include "test_common.h"
+
+static void CheckPooled(const Feeder& feeder, CVector& B, const CVector& X0, uint64_t opts)
+{
+    void* handle = NewFeederSet(feeder, opts | Option_PooledKLUMemory);
+    CVector X;
+    TEST_CHECK(Solve(handle, X, B) == 1);
+    TEST_CHECK(RelativeDiff(X, X0) < testTolerance);
+    KLUSolveXStats stats;
+    GetStats(handle, &stats);
+    TEST_CHECK(stats.kluPoolMisses > 0);
+    TEST_CHECK(stats.kluPoolBytes > 0 && stats.kluPoolBytes <= stats.kluPoolPeak);
+
+    // a new pattern, analyzed and factored again with the freed blocks
+    ZeroSparseSet(handle);
+    AddFeeder(handle, feeder);
+    TEST_CHECK(Solve(handle, X, B) == 1);
+    TEST_CHECK(RelativeDiff(X, X0) < testTolerance);
+    GetStats(handle, &stats);
+    TEST_CHECK(stats.kluPoolHits > 0);
+
+    // without the option, KLU allocates as usual
+    const uint64_t hits = stats.kluPoolHits;
+    SetOptions(handle, opts);
+    ZeroSparseSet(handle);
+    AddFeeder(handle, feeder);
+    TEST_CHECK(Solve(handle, X, B) == 1);
+    TEST_CHECK(RelativeDiff(X, X0) < testTolerance);
+    GetStats(handle, &stats);
+    TEST_CHECK(stats.kluPoolHits == hits);
+
+    DeleteSparseSet(handle);
+}
+
+int main()
+{
+    const Feeder feeder = GenerateIslands(200, 3, 0.1, 6);
+    CVector B = RandomInjections(feeder.nNodes, 12);
+    const CVector X0 = ReferenceSolve(feeder, B);
+
+    CheckPooled(feeder, B, X0, 0);
+    // the worker threads allocate from the pool of the system too
+    CheckPooled(feeder, B, X0, Option_BlockFactorization | Option_ParallelFactorization);
+
+    return TestResult("pooled_memory");
+}
@@ -0,0 +1,57 @@
+/* ------------------------------------------------------------------------- */
+/* DSS-Extensions KLUSolve (KLUSolveX)                                       */
+/* Copyright (c) 2019-2024, Paulo Meira                                      */
+/* Licensed under the GNU Lesser General Public License (LGPL) v 2.1         */
+/* ------------------------------------------------------------------------- */
+
+// SolveSparseRHS: the requested entries must match a full solve of the
+// dense right-hand side, also with a low-rank update applied.
+
+#include "test_common.h"
+
+int main()
+{
+    const Feeder feeder = GenerateFeeder(150, 0.1, 5);
+    const unsigned int n = feeder.nNodes;
+
+    // injections at a few nodes, one of them given twice
+    std::vector<unsigned int> idxB = { 7, n - 2, 40, 7 };
+    CVector valB = { { 1, -0.5 }, { 0.25, 0.25 }, { -2, 1 }, { 0.5, 0.5 } };
+    CVector B(n);
+    for (size_t k = 0; k < idxB.size(); ++k)
+        B[idxB[k]] += valB[k];
+
+    std::vector<unsigned int> idxOut = { 0, 7, 41, n / 2, n - 1 };
+    CVector valOut(idxOut.size());
+
+    void* handle = NewFeederSet(feeder, 0);
+    const CVector X0 = ReferenceSolve(feeder, B);
+    TEST_CHECK(SolveSparseRHS(handle, idxB.size(), idxB.data(), AsComplex(valB.data()), idxOut.size(), idxOut.data(), AsComplex(valOut.data())) == 1);
+    for (size_t k = 0; k < idxOut.size(); ++k)
+        TEST_CHECK(std::abs(valOut[k] - X0[idxOut[k]]) < testTolerance * std::abs(X0[idxOut[k]]));
+
+    // the low-rank correction applies to the requested entries
+    Primitive change = MakeLine(0, 1, 1.0);
+    std::vector<unsigned int> rows, cols;
+    for (unsigned int j = 0; j < 6; ++j)
+    {
+        for (unsigned int i = 0; i < 6; ++i)
+        {
+            rows.push_back(change.nodes[i]);
+            cols.push_back(change.nodes[j]);
+        }
+    }
+    Feeder changed = feeder;
+    changed.primitives.push_back(change);
+    const CVector X1 = ReferenceSolve(changed, B);
+    TEST_CHECK(AddLowRankUpdate(handle, rows.size(), rows.data(), cols.data(), AsComplex(change.Y.data())) == 1);
+    TEST_CHECK(SolveSparseRHS(handle, idxB.size(), idxB.data(), AsComplex(valB.data()), idxOut.size(), idxOut.data(), AsComplex(valOut.data())) == 1);
+    for (size_t k = 0; k < idxOut.size(); ++k)
+        TEST_CHECK(std::abs(valOut[k] - X1[idxOut[k]]) < testTolerance * std::abs(X1[idxOut[k]]));
+
+    unsigned int outOfRange = n;
+    TEST_CHECK(SolveSparseRHS(handle, 1, &outOfRange, AsComplex(valB.data()), idxOut.size(), idxOut.data(), AsComplex(valOut.data())) == 0);
+
+    DeleteSparseSet(handle);
+    return TestResult("sparse_rhs");
+}
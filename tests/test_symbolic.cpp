@@ -0,0 +1,69 @@
+/* ------------------------------------------------------------------------- */
+/* DSS-Extensions KLUSolve (KLUSolveX)                                       */
+/* Copyright (c) 2019-2024, Paulo Meira                                      */
+/* Licensed under the GNU Lesser General Public License (LGPL) v 2.1         */
+/* ------------------------------------------------------------------------- */
+
+// SaveSymbolic/LoadSymbolic: a system analyzed with the loaded ordering must
+// solve as a plain factorization, and keep the saved P, Q and blocks (the
+// islands are separate BTF blocks), so saving it again gives the same file.
+
+#include "test_common.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+static std::string ReadFile(const char* path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+int main()
+{
+    const char* savedPath = "test_symbolic_saved.bin";
+    const char* resavedPath = "test_symbolic_resaved.bin";
+    const char* corruptPath = "test_symbolic_corrupt.bin";
+
+    const Feeder feeder = GenerateIslands(240, 3, 0.1, 9);
+    const unsigned int n = feeder.nNodes;
+    CVector B = RandomInjections(n, 3);
+    const CVector X0 = ReferenceSolve(feeder, B);
+
+    void* handle = NewFeederSet(feeder, 0);
+    CVector X;
+    TEST_CHECK(Solve(handle, X, B) == 1);
+    TEST_CHECK(SaveSymbolic(handle, savedPath) == 1);
+    DeleteSparseSet(handle);
+
+    handle = NewSparseSet(n);
+    TEST_CHECK(LoadSymbolic(handle, savedPath) == 1);
+    AddFeeder(handle, feeder);
+    TEST_CHECK(Solve(handle, X, B) == 1);
+    TEST_CHECK(RelativeDiff(X, X0) < testTolerance);
+    KLUSolveXStats stats;
+    GetStats(handle, &stats);
+    TEST_CHECK(stats.symbolicGiven == 1);
+    TEST_CHECK(SaveSymbolic(handle, resavedPath) == 1);
+    TEST_CHECK(ReadFile(savedPath) == ReadFile(resavedPath));
+    DeleteSparseSet(handle);
+
+    // the last block boundary must be the system size
+    std::string contents = ReadFile(savedPath);
+    contents[contents.size() - sizeof(int32_t)] ^= 1;
+    std::ofstream(corruptPath, std::ios::binary) << contents;
+    handle = NewSparseSet(n);
+    TEST_CHECK(LoadSymbolic(handle, corruptPath) == 0);
+    DeleteSparseSet(handle);
+
+    handle = NewSparseSet(n + 3);
+    TEST_CHECK(LoadSymbolic(handle, savedPath) == 0);
+    DeleteSparseSet(handle);
+
+    std::remove(savedPath);
+    std::remove(resavedPath);
+    std::remove(corruptPath);
+    return TestResult("symbolic");
+}